@@ -239,6 +239,16 @@ ifneq "$(strip $(TRACE_HYPERCALL) $(TRACE_VIRT_ALL))" ""
 KERN_DEBUG_FLAGS	+= -DTRACE_HYPERCALL -DTRACE_VIRT -DDEBUG_HVM -DDEBUG_MSG
 endif
 
+#
+# Kernel configuration switches.
+#
+
+# If set, load the kernel's page structure on every trap from user mode,
+# instead of staying on the page structure of the current process.
+ifneq "$(strip $(EAGER_CR3))" ""
+KERN_DEBUG_FLAGS	+= -DEAGER_CR3
+endif
+
 # If set, enable the test mode.
 ifneq "$(TEST)" ""
 KERN_DEBUG_FLAGS += -DTEST
@@ -52,6 +52,8 @@ void devinit_ap(void)
     /* kernel stack for this cpu initialized */
     seg_init(ks->cpu_idx);
 
+    enable_sse();
+
     pcpu_init();
     KERN_INFO("[AP%d KERN] PCPU initialized\n", ks->cpu_idx);
 
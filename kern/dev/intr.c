@@ -24,6 +24,7 @@ extern char Xirq_timer, Xirq_kbd, Xirq_slave, Xirq_serial2, Xirq_serial1,
             Xirq_lpt, Xirq_floppy, Xirq_spurious, Xirq_rtc, Xirq9, Xirq10, Xirq11,
             Xirq_mouse, Xirq_coproc, Xirq_ide1, Xirq_ide2;
 extern char Xsyscall;
+extern char Xipi_invalc;
 extern char Xdefault;
 
 /* Interrupt Descriptors Table */
@@ -81,6 +82,9 @@ static void intr_init_idt(void)
     // by the user process (with "int $T_SYSCALL").
     SETGATE(idt[T_SYSCALL], 0, CPU_GDT_KCODE, &Xsyscall, 3);
 
+    /* IPIs */
+    SETGATE(idt[T_IPI0 + IPI_INVALC], 0, CPU_GDT_KCODE, &Xipi_invalc, 0);
+
     /* default */
     SETGATE(idt[T_DEFAULT], 0, CPU_GDT_KCODE, &Xdefault, 0);
 }
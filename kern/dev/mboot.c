@@ -22,6 +22,9 @@ static int pmmap_slots_next_free = 0;
 static SLIST_HEAD(, pmmap) pmmap_list;  /* all memory regions */
 static SLIST_HEAD(, pmmap) pmmap_sublist[4];
 
+/* pmmap_list indexed by position, so that the getters below are O(1) */
+static struct pmmap *pmmap_table[128];
+
 enum __pmmap_type { PMMAP_USABLE, PMMAP_RESV, PMMAP_ACPI, PMMAP_NVS };
 
 #define PMMAP_SUBLIST_NR(type)               \
@@ -173,10 +176,10 @@ void pmmap_init(uintptr_t mbi_addr)
     pmmap_merge();
     pmmap_dump();
 
-    /* count the number of pmmap entries */
+    /* count and index the pmmap entries */
     struct pmmap *slot;
     SLIST_FOREACH(slot, &pmmap_list, next) {
-        pmmap_nentries++;
+        pmmap_table[pmmap_nentries++] = slot;
     }
 
     /* Calculate the maximum page number */
@@ -190,55 +193,31 @@ int get_size(void)
 
 uint32_t get_mms(int idx)
 {
-    int i = 0;
-    struct pmmap *slot = NULL;
-
-    SLIST_FOREACH(slot, &pmmap_list, next) {
-        if (i == idx)
-            break;
-        i++;
-    }
-
-    if (slot == NULL || i == pmmap_nentries)
+    if (idx < 0 || idx >= pmmap_nentries)
         return 0;
 
-    return slot->start;
+    return pmmap_table[idx]->start;
 }
 
 uint32_t get_mml(int idx)
 {
-    int i = 0;
-    struct pmmap *slot = NULL;
-
-    SLIST_FOREACH(slot, &pmmap_list, next) {
-        if (i == idx)
-            break;
-        i++;
-    }
-
-    if (slot == NULL || i == pmmap_nentries)
+    if (idx < 0 || idx >= pmmap_nentries)
         return 0;
 
-    return slot->end - slot->start;
+    return pmmap_table[idx]->end - pmmap_table[idx]->start;
 }
 
 int is_usable(int idx)
 {
-    int i = 0;
-    struct pmmap *slot = NULL;
-
-    SLIST_FOREACH(slot, &pmmap_list, next) {
-        if (i == idx)
-            break;
-        i++;
-    }
-
-    if (slot == NULL || i == pmmap_nentries)
+    if (idx < 0 || idx >= pmmap_nentries)
         return 0;
 
-    return slot->type == MEM_RAM;
+    return pmmap_table[idx]->type == MEM_RAM;
 }
 
+// The CR3 value of the kernel's page structure, recorded when paging is turned on.
+static uint32_t kern_cr3 = 0;
+
 void set_cr3(unsigned int **pdir)
 {
     lcr3((uint32_t) pdir);
@@ -246,14 +225,37 @@ void set_cr3(unsigned int **pdir)
 
 void enable_paging(void)
 {
-    /* enable global pages (Sec 4.10.2.4, Intel ASDM Vol3) */
+    /*
+     * enable global pages (Sec 4.10.2.4, Intel ASDM Vol3), so the kernel
+     * mappings (PTE_G) stay in the TLB when CR3 is reloaded on a process
+     * switch, and 4MB pages for the identity map (Sec 4.3); the identity map
+     * is built from 4MB pages only, so the kernel cannot run without PSE
+     */
+    uint32_t edx;
     uint32_t cr4 = rcr4();
-    cr4 |= CR4_PGE;
+    cpuid(0x1, NULL, NULL, NULL, &edx);
+    if (!(edx & CPUID_FEATURE_PSE))
+        KERN_PANIC("The CPU does not support 4MB pages (PSE).\n");
+    cr4 |= CR4_PSE;
+    if (edx & CPUID_FEATURE_PGE)
+        cr4 |= CR4_PGE;
     lcr4(cr4);
 
+    /* the caller has loaded the kernel's page structure */
+    kern_cr3 = rcr3();
+
     /* turn on paging */
     uint32_t cr0 = rcr0();
     cr0 |= CR0_PE | CR0_PG | CR0_AM | CR0_WP | CR0_NE | CR0_MP;
     cr0 &= ~(CR0_EM | CR0_TS);
     lcr0(cr0);
 }
+
+/**
+ * Returns the CR3 value of the kernel's page structure, or 0 before paging is
+ * turned on, when the physical memory is accessed directly.
+ */
+uint32_t get_kern_cr3(void)
+{
+    return kern_cr3;
+}
@@ -93,6 +93,7 @@ uint32_t pmmap_get_entry_start(int idx);
 uint32_t pmmap_get_entry_length(int idx);
 void set_cr3(unsigned int **pdir);
 void enable_paging(void);
+uint32_t get_kern_cr3(void);
 
 #endif  /* _KERN_ */
 
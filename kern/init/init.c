@@ -1,18 +1,34 @@
 #include <lib/debug.h>
+#include <lib/elf.h>
+#include <lib/vmregion.h>
+#include <lib/wset.h>
 #include <lib/types.h>
 #include <lib/kstack.h>
 #include <lib/thread.h>
 #include <lib/x86.h>
 #include <dev/devinit.h>
 #include <pcpu/PCPUIntro/export.h>
+#include <pmm/MATOp/export.h>
 #include <proc/PProc/export.h>
 #include <thread/PCurID/export.h>
 #include <thread/PKCtxIntro/export.h>
 #include <thread/PTCBIntro/export.h>
 #include <thread/PTQueueInit/export.h>
 #include <thread/PThread/export.h>
+#include <vmm/MPTKern/export.h>
 
 #ifdef TEST
+extern bool test_MATIntro(void);
+extern bool test_MATInit(void);
+extern bool test_MATOp(void);
+extern bool test_MContainer(void);
+extern void test_MContainer_ap(void);
+extern bool test_MPTIntro(void);
+extern bool test_MPTOp(void);
+extern bool test_MPTComm(void);
+extern bool test_MPTKern(void);
+extern void test_MPTKern_ap(void);
+extern bool test_MPTNew(void);
 extern bool test_PKCtxNew(void);
 extern bool test_PTCBInit(void);
 extern bool test_PTQueueInit(void);
@@ -26,9 +42,32 @@ static volatile int cpu_booted = 0;
 static volatile int all_ready = FALSE;
 static void kern_main_ap(void);
 
+// The number of pages an idle CPU zeroes before it checks the pool again.
+#define IDLE_ZERO_BATCH 8
+
 extern uint8_t _binary___obj_user_idle_idle_start[];
 extern uint8_t _binary___obj_user_pingpong_ping_start[];
 extern uint8_t _binary___obj_user_pingpong_pong_start[];
+extern uint8_t _binary___obj_user_bench_sysbench_start[];
+extern uint8_t _binary___obj_user_bench_fairbench_start[];
+
+#ifndef TEST
+/**
+ * The idle loop of a CPU that has no process to run.
+ * It keeps the pool of pre-zeroed pages filled, and spins once the pool is full.
+ * Interrupts are disabled in the kernel, so it handles the TLB invalidations
+ * queued by the other CPUs itself (see tlb_shootdown_kern).
+ */
+static void kern_idle(void)
+{
+    while (1) {
+        tlb_shootdown_handle();
+        if (palloc_zero_refill(IDLE_ZERO_BATCH) == 0) {
+            pause();
+        }
+    }
+}
+#endif
 
 static void kern_main(void)
 {
@@ -55,6 +94,78 @@ static void kern_main(void)
     all_ready = TRUE;
 
 #ifdef TEST
+    dprintf("Testing the MATIntro layer...\n");
+    if (test_MATIntro() == 0) {
+        dprintf("All tests passed.\n");
+    } else {
+        dprintf("Test failed.\n");
+    }
+    dprintf("\n");
+
+    dprintf("Testing the MATInit layer...\n");
+    if (test_MATInit() == 0) {
+        dprintf("All tests passed.\n");
+    } else {
+        dprintf("Test failed.\n");
+    }
+    dprintf("\n");
+
+    dprintf("Testing the MATOp layer...\n");
+    if (test_MATOp() == 0) {
+        dprintf("All tests passed.\n");
+    } else {
+        dprintf("Test failed.\n");
+    }
+    dprintf("\n");
+
+    dprintf("Testing the MContainer layer...\n");
+    if (test_MContainer() == 0) {
+        dprintf("All tests passed.\n");
+    } else {
+        dprintf("Test failed.\n");
+    }
+    dprintf("\n");
+
+    dprintf("Testing the MPTIntro layer...\n");
+    if (test_MPTIntro() == 0) {
+        dprintf("All tests passed.\n");
+    } else {
+        dprintf("Test failed.\n");
+    }
+    dprintf("\n");
+
+    dprintf("Testing the MPTOp layer...\n");
+    if (test_MPTOp() == 0) {
+        dprintf("All tests passed.\n");
+    } else {
+        dprintf("Test failed.\n");
+    }
+    dprintf("\n");
+
+    dprintf("Testing the MPTComm layer...\n");
+    if (test_MPTComm() == 0) {
+        dprintf("All tests passed.\n");
+    } else {
+        dprintf("Test failed.\n");
+    }
+    dprintf("\n");
+
+    dprintf("Testing the MPTKern layer...\n");
+    if (test_MPTKern() == 0) {
+        dprintf("All tests passed.\n");
+    } else {
+        dprintf("Test failed.\n");
+    }
+    dprintf("\n");
+
+    dprintf("Testing the MPTNew layer...\n");
+    if (test_MPTNew() == 0) {
+        dprintf("All tests passed.\n");
+    } else {
+        dprintf("Test failed.\n");
+    }
+    dprintf("\n");
+
     dprintf("Testing the PKCtxNew layer...\n");
     if (test_PKCtxNew() == 0) {
         dprintf("All tests passed.\n");
@@ -87,12 +198,15 @@ static void kern_main(void)
     }
     dprintf("\n");
     dprintf("\nTest complete. Please Use Ctrl-a x to exit qemu.");
+#else
+    kern_idle();
 #endif
 }
 
 static void kern_main_ap(void)
 {
     unsigned int pid, pid2;
+    unsigned long long tsc;
     int cpu_idx = get_pcpu_idx();
 
     set_pcpu_boot_info(cpu_idx, TRUE);
@@ -103,23 +217,46 @@ static void kern_main_ap(void)
 
     cpu_booted++;
 
-#ifndef TEST
+#ifdef TEST
+    // Join the multi-CPU tests run by the bootstrap processor.
+    test_MContainer_ap();
+    test_MPTKern_ap();
+#else
     if (cpu_idx == 1) {
+        tsc = rdtsc();
         pid = proc_create(_binary___obj_user_pingpong_ping_start, 1000);
-        KERN_INFO("CPU%d: process ping1 %d is created.\n", cpu_idx, pid);
+        KERN_INFO("CPU%d: process ping1 %d is created in %llu cycles.\n",
+                  cpu_idx, pid, rdtsc() - tsc);
+        // The second instance shares the text pages of the first one.
+        tsc = rdtsc();
         pid2 = proc_create(_binary___obj_user_pingpong_ping_start, 1000);
-        KERN_INFO("CPU%d: process ping2 %d is created.\n", cpu_idx, pid2);
+        KERN_INFO("CPU%d: process ping2 %d is created in %llu cycles.\n",
+                  cpu_idx, pid2, rdtsc() - tsc);
         proc_create(_binary___obj_user_idle_idle_start, 1000);
     }
     else if (cpu_idx == 2) {
+        tsc = rdtsc();
         pid = proc_create(_binary___obj_user_pingpong_pong_start, 1000);
-        KERN_INFO("CPU%d: process pong1 %d is created.\n", cpu_idx, pid);
+        KERN_INFO("CPU%d: process pong1 %d is created in %llu cycles.\n",
+                  cpu_idx, pid, rdtsc() - tsc);
+        // The second instance shares the text pages of the first one.
+        tsc = rdtsc();
         pid2 = proc_create(_binary___obj_user_pingpong_pong_start, 1000);
-        KERN_INFO("CPU%d: process pong2 %d is created.\n", cpu_idx, pid2);
+        KERN_INFO("CPU%d: process pong2 %d is created in %llu cycles.\n",
+                  cpu_idx, pid2, rdtsc() - tsc);
+        proc_create(_binary___obj_user_idle_idle_start, 1000);
+    }
+    else if (cpu_idx == 3) {
+        // Enough quota for the 8MB buffer of the streaming benchmark.
+        pid = proc_create(_binary___obj_user_bench_sysbench_start, 4096);
+        KERN_INFO("CPU%d: process sysbench %d is created.\n", cpu_idx, pid);
         proc_create(_binary___obj_user_idle_idle_start, 1000);
+        // Forks its CPU-bound processes, which share the CPU with the above.
+        pid2 = proc_create(_binary___obj_user_bench_fairbench_start, 1000);
+        KERN_INFO("CPU%d: process fairbench %d is created.\n", cpu_idx, pid2);
     }
     else
-        return;
+        kern_idle();
 
     tqueue_remove(NUM_IDS + cpu_idx, pid);
     tcb_set_state(pid, TSTATE_RUN);
@@ -133,6 +270,9 @@ static void kern_main_ap(void)
 void kern_init(uintptr_t mbi_addr)
 {
     thread_init(mbi_addr);
+    vmregion_init();
+    wset_init();
+    elf_cache_init();
     KERN_INFO("[BSP KERN] Kernel initialized.\n");
     kern_main();
 }
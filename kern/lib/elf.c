@@ -5,7 +5,8 @@
 #include <lib/x86.h>
 #include <lib/pmap.h>
 #include <lib/gcc.h>
-#include <vmm/MPTNew/export.h>
+#include <lib/spinlock.h>
+#include <lib/vmregion.h>
 
 #define VM_TOP     0xffffffff
 #define VM_USERHI  0xf0000000
@@ -14,10 +15,108 @@
 #define VM_USERLO  0x40000000
 #define VM_BOTTOM  0x00000000
 
+/*
+ * The cache of the read-only segments of the loaded ELF images, keyed by the
+ * address of the image and the virtual address of the segment.
+ * It holds the physical pages of each cached segment, which are filled
+ * on demand by the first process that touches them (see vmr_fault), and
+ * mapped read-only by all the instances of the image, so neither a write of
+ * the process nor pt_copyout can change their content.
+ * Segments larger than ELF_TEXT_PAGES pages are not cached.
+ */
+#define ELF_TEXT_SLOTS 16
+#define ELF_TEXT_PAGES 64
+
+struct elf_text {
+    uintptr_t exe;   /* the ELF image, 0 if the slot is free */
+    uint32_t va;     /* the page aligned start of the segment */
+    uint32_t pages[ELF_TEXT_PAGES];
+};
+
+static struct elf_text elf_text_cache[ELF_TEXT_SLOTS];
+static spinlock_t elf_text_lk;
+
+void elf_cache_init(void)
+{
+    spinlock_init(&elf_text_lk);
+    memzero(elf_text_cache, sizeof(elf_text_cache));
+}
+
+/*
+ * Returns the shared pages of the read-only segment of image exe starting
+ * at va, taking a free slot for the first load of the segment.
+ * Returns NULL if the segment cannot be cached.
+ */
+static uint32_t *elf_text_get(uintptr_t exe, uint32_t va, uint32_t npages)
+{
+    struct elf_text *text = NULL;
+    int i;
+
+    if (npages > ELF_TEXT_PAGES)
+        return NULL;
+
+    spinlock_acquire(&elf_text_lk);
+    for (i = 0; i < ELF_TEXT_SLOTS; i++) {
+        if (elf_text_cache[i].exe == exe && elf_text_cache[i].va == va) {
+            text = &elf_text_cache[i];
+            break;
+        }
+        if (text == NULL && elf_text_cache[i].exe == 0)
+            text = &elf_text_cache[i];
+    }
+    if (text != NULL && text->exe == 0) {
+        text->exe = exe;
+        text->va = va;
+    }
+    spinlock_release(&elf_text_lk);
+
+    return text == NULL ? NULL : text->pages;
+}
+
+/*
+ * Returns whether two of the loadable segments in [ph, eph) that lie in the
+ * user part of the address space share a page. Such a page would be filled
+ * from the region of one of them only (see vmr_find), and lose the bytes of
+ * the other one.
+ */
+static bool elf_segments_overlap(proghdr *ph, proghdr *eph)
+{
+    proghdr *ph2;
+    uint32_t va, eva, va2, eva2;
+
+    for (; ph < eph; ph++) {
+        if (ph->p_type != ELF_PROG_LOAD)
+            continue;
+        va = rounddown(ph->p_va, PAGESIZE);
+        eva = roundup(ph->p_va + ph->p_memsz, PAGESIZE);
+        if (va < VM_USERLO || eva > VM_USERHI)
+            continue;
+
+        for (ph2 = ph + 1; ph2 < eph; ph2++) {
+            if (ph2->p_type != ELF_PROG_LOAD)
+                continue;
+            va2 = rounddown(ph2->p_va, PAGESIZE);
+            eva2 = roundup(ph2->p_va + ph2->p_memsz, PAGESIZE);
+            if (va2 < VM_USERLO || eva2 > VM_USERHI)
+                continue;
+            if (va < eva2 && va2 < eva)
+                return TRUE;
+        }
+    }
+
+    return FALSE;
+}
+
 /*
  * Load elf execution file exe to the virtual address space pmap.
+ * No page is allocated here: each loadable segment is registered as a region
+ * of the process, which is filled on demand from the image (see vmregion.c).
+ * The read-only segments share their pages with the other instances of the
+ * same file.
+ * Returns 0, or -1 if the image has loadable segments that share a page, or
+ * more segments than a process has regions.
  */
-void elf_load(void *exe_ptr, int pid)
+int elf_load(void *exe_ptr, int pid)
 {
     elfhdr *eh;
     proghdr *ph, *eph;
@@ -39,38 +138,41 @@ void elf_load(void *exe_ptr, int pid)
     ph = (proghdr *) ((uintptr_t) eh + eh->e_phoff);
     eph = ph + eh->e_phnum;
 
+    if (elf_segments_overlap(ph, eph)) {
+        KERN_WARN("The segments of the ELF image 0x%08x share pages.\n", exe);
+        return -1;
+    }
+
+    vmr_init(pid);
+
     for (; ph < eph; ph++) {
-        uintptr_t fa;
-        uint32_t va, zva, eva, perm;
+        uint32_t va, eva, perm;
+        uint32_t *shared = NULL;
 
         if (ph->p_type != ELF_PROG_LOAD)
             continue;
 
-        fa = (uintptr_t) eh + rounddown(ph->p_offset, PAGESIZE);
         va = rounddown(ph->p_va, PAGESIZE);
-        zva = ph->p_va + ph->p_filesz;
         eva = roundup(ph->p_va + ph->p_memsz, PAGESIZE);
 
+        /* e.g., the ELF headers loaded right below VM_USERLO */
+        if (va < VM_USERLO || eva > VM_USERHI)
+            continue;
+
         perm = PTE_U | PTE_P;
         if (ph->p_flags & ELF_PROG_FLAG_WRITE)
             perm |= PTE_W;
+        else
+            shared = elf_text_get(exe, va, (eva - va) / PAGESIZE);
 
-        for (; va < eva; va += PAGESIZE, fa += PAGESIZE) {
-            alloc_page(pid, va, perm);
-
-            if (va < rounddown(zva, PAGESIZE)) {
-                /* copy a complete page */
-                pt_copyout((void *) fa, pid, va, PAGESIZE);
-            } else if (va < zva && ph->p_filesz) {
-                /* copy a partial page */
-                pt_memset(pid, va, 0, PAGESIZE);
-                pt_copyout((void *) fa, pid, va, zva - va);
-            } else {
-                /* zero a page */
-                pt_memset(pid, va, 0, PAGESIZE);
-            }
+        if (vmr_add(pid, va, eva, perm, exe + ph->p_offset, ph->p_va,
+                    ph->p_va + ph->p_filesz, shared) != 0) {
+            KERN_WARN("Too many segments in the ELF image 0x%08x.\n", exe);
+            return -1;
         }
     }
+
+    return 0;
 }
 
 uintptr_t elf_entry(void *exe_ptr)
@@ -9,7 +9,11 @@
 #include <lib/x86.h>
 #include <lib/thread.h>
 #include <lib/monitor.h>
+#include <lib/vmregion.h>
+#include <lib/wset.h>
 #include <dev/console.h>
+#include <pmm/MATOp/export.h>
+#include <pmm/MContainer/export.h>
 #include <vmm/MPTIntro/export.h>
 #include <vmm/MPTNew/export.h>
 
@@ -25,6 +29,9 @@ struct Command {
 static struct Command commands[] = {
     {"help", "Display this list of commands", mon_help},
     {"kerninfo", "Display information about the kernel", mon_kerninfo},
+    {"pcache", "Display the counters of the per-CPU page caches and the pre-zeroed page pool", mon_pcache},
+    {"faults", "Display the fault-around window, the page faults taken, the pages mapped and those pre-zeroed for each process", mon_faults},
+    {"wset", "Display the working set estimates and the memory quota of each process", mon_wset},
 };
 
 #define NCOMMANDS (sizeof(commands) / sizeof(commands[0]))
@@ -53,6 +60,59 @@ int mon_kerninfo(int argc, char **argv, struct Trapframe *tf)
     return 0;
 }
 
+int mon_pcache(int argc, char **argv, struct Trapframe *tf)
+{
+    unsigned int cpu_idx, allocs, hits;
+
+    dprintf("CPU     allocs       hits  hit%%   refills    drains\n");
+    for (cpu_idx = 0; cpu_idx < NUM_CPUS; cpu_idx++) {
+        allocs = pcache_get_allocs(cpu_idx);
+        if (allocs == 0)
+            continue;
+        hits = pcache_get_hits(cpu_idx);
+        dprintf("%3d %10u %10u  %3u%% %9u %9u\n", cpu_idx, allocs, hits,
+                (unsigned int) ((uint64_t) hits * 100 / allocs),
+                pcache_get_refills(cpu_idx), pcache_get_drains(cpu_idx));
+    }
+    dprintf("free pages: %u\n", palloc_nr_free());
+    dprintf("pre-zeroed pages: %u, zeroed pages served from the pool: %u, cleared inline: %u\n",
+            zpool_get_nr(), zpool_get_hits(), zpool_get_misses());
+    return 0;
+}
+
+int mon_faults(int argc, char **argv, struct Trapframe *tf)
+{
+    unsigned int pid, nfaults;
+
+    dprintf("PID window     faults      pages pre-zeroed\n");
+    for (pid = 0; pid < NUM_IDS; pid++) {
+        nfaults = vmr_get_nfaults(pid);
+        if (nfaults == 0)
+            continue;
+        dprintf("%3d %6u %10u %10u %10u\n", pid, vmr_get_window(pid), nfaults,
+                vmr_get_npages(pid), vmr_get_nprezeroed(pid));
+    }
+    return 0;
+}
+
+int mon_wset(int argc, char **argv, struct Trapframe *tf)
+{
+    struct wset ws;
+    unsigned int pid;
+
+    dprintf("scan period: %u ticks\n", WSET_PERIOD);
+    dprintf("PID   resident    average       peak        hot      dirty      quota      usage\n");
+    for (pid = 1; pid < NUM_IDS; pid++) {
+        wset_get(pid, &ws);
+        if (ws.scans == 0)
+            continue;
+        dprintf("%3d %10u %10u %10u %10u %10u %10u %10u\n", pid, ws.resident,
+                ws.avg, ws.peak, ws.hot, ws.dirty, container_get_quota(pid),
+                container_get_usage(pid));
+    }
+    return 0;
+}
+
 /***** Kernel monitor command interpreter *****/
 #define WHITESPACE "\t\r\n "
 #define MAXARGS    16
@@ -13,6 +13,9 @@ void monitor(struct Trapframe *tf);
 // Functions implementing monitor commands.
 int mon_help(int argc, char **argv, struct Trapframe *tf);
 int mon_kerninfo(int argc, char **argv, struct Trapframe *tf);
+int mon_pcache(int argc, char **argv, struct Trapframe *tf);
+int mon_faults(int argc, char **argv, struct Trapframe *tf);
+int mon_wset(int argc, char **argv, struct Trapframe *tf);
 
 #endif  /* _KERN_ */
 
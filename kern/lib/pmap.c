@@ -1,20 +1,153 @@
 #include <lib/pmap.h>
 #include <lib/string.h>
 #include <lib/types.h>
+#include <lib/vmregion.h>
 
 #define PTE_P 0x001  /* Present */
 #define PTE_W 0x002  /* Writeable */
 #define PTE_U 0x004  /* User-accessible */
+#define PTE_PS 0x080 /* Page size */
+#define PTE_COW 0x800 /* Copy-on-write */
+
+#define CR4_OSFXSR 0x00000200  /* OS supports FXSAVE/FXRSTOR (and SSE) */
 
 #define PAGESIZE 4096
 
 #define VM_USERHI 0xf0000000
 #define VM_USERLO 0x40000000
 
-extern void alloc_page(unsigned int pid, unsigned int vaddr,
-                       unsigned int perm);
 extern unsigned int get_ptbl_entry_by_va(unsigned int pid,
                                          unsigned int vaddr);
+extern unsigned int get_pdir_entry_by_va(unsigned int pid,
+                                         unsigned int vaddr);
+extern unsigned int copy_on_write(unsigned int pid, unsigned int vaddr);
+extern void pdir_use_kern(void);
+extern uint32_t rcr4(void);
+
+/*
+ * Remembers the page table of the last 4MB slot that was looked up, so that
+ * the translation of consecutive pages of a buffer reads the page directory
+ * only once per slot instead of walking both levels for every page.
+ * It lives for the duration of one call.
+ */
+struct pt_tcache {
+    uint32_t pmap_id;
+    uint32_t pde_index;  /* the cached slot, or PT_TCACHE_NONE */
+    uint32_t *ptbl;      /* its page table, NULL for a 4MB page */
+    bool sse;            /* whether whole pages are copied with SSE */
+};
+
+#define PT_TCACHE_NONE 0xffffffff
+
+static void pt_tcache_init(struct pt_tcache *tc, uint32_t pmap_id)
+{
+    tc->pmap_id = pmap_id;
+    tc->pde_index = PT_TCACHE_NONE;
+    tc->ptbl = NULL;
+    tc->sse = (rcr4() & CR4_OSFXSR) ? TRUE : FALSE;
+}
+
+/*
+ * Returns the page table entry for [va], mapping the page if it is not
+ * mapped yet (see vmr_fault). If the kernel is going to [write] to the page, a page shared
+ * copy-on-write is copied first, as if the process itself wrote to it.
+ * The entry is not present if va is in no region of the process, or if the
+ * kernel is going to write to a page the process cannot write to.
+ */
+static uint32_t pt_translate(struct pt_tcache *tc, uintptr_t va, bool write)
+{
+    uint32_t pde_index = va >> 22;
+    uint32_t pde, pte;
+
+    if (pde_index != tc->pde_index) {
+        pde = get_pdir_entry_by_va(tc->pmap_id, va);
+        tc->ptbl = ((pde & PTE_P) && !(pde & PTE_PS)) ?
+            (uint32_t *) (pde & 0xfffff000) : NULL;
+        tc->pde_index = (pde & PTE_P) ? pde_index : PT_TCACHE_NONE;
+    }
+
+    pte = tc->ptbl != NULL ?
+        tc->ptbl[(va >> 12) & 0x3ff] : get_ptbl_entry_by_va(tc->pmap_id, va);
+
+    if ((pte & PTE_P) == 0) {
+        vmr_fault(tc->pmap_id, va);
+        // The page table may have been allocated just now.
+        tc->pde_index = PT_TCACHE_NONE;
+        pte = get_ptbl_entry_by_va(tc->pmap_id, va);
+    }
+
+    if (write && (pte & PTE_COW)) {
+        copy_on_write(tc->pmap_id, va);
+        pte = get_ptbl_entry_by_va(tc->pmap_id, va);
+    }
+
+    if (write && !(pte & PTE_W))
+        return 0;
+
+    return pte;
+}
+
+/*
+ * Copies a whole 4KB page with 16-byte SSE loads and stores, 64 bytes at
+ * a time. The kernel does not save the SSE state of the user process on
+ * traps, so the registers used are saved and restored around the copy.
+ */
+static void page_copy_sse(void *dst, const void *src)
+{
+    uint8_t save[64];
+    uint32_t i;
+
+    asm volatile ("movups %%xmm0, 0(%0)\n\t"
+                  "movups %%xmm1, 16(%0)\n\t"
+                  "movups %%xmm2, 32(%0)\n\t"
+                  "movups %%xmm3, 48(%0)"
+                  :: "r" (save) : "memory");
+
+    for (i = 0; i < PAGESIZE; i += 64) {
+        asm volatile ("movups 0(%1), %%xmm0\n\t"
+                      "movups 16(%1), %%xmm1\n\t"
+                      "movups 32(%1), %%xmm2\n\t"
+                      "movups 48(%1), %%xmm3\n\t"
+                      "movups %%xmm0, 0(%0)\n\t"
+                      "movups %%xmm1, 16(%0)\n\t"
+                      "movups %%xmm2, 32(%0)\n\t"
+                      "movups %%xmm3, 48(%0)"
+                      :: "r" ((uint8_t *) dst + i), "r" ((const uint8_t *) src + i)
+                      : "memory");
+    }
+
+    asm volatile ("movups 0(%0), %%xmm0\n\t"
+                  "movups 16(%0), %%xmm1\n\t"
+                  "movups 32(%0), %%xmm2\n\t"
+                  "movups 48(%0), %%xmm3"
+                  :: "r" (save) : "memory");
+}
+
+static void pt_memcpy(struct pt_tcache *tc, void *dst, const void *src,
+                      size_t size)
+{
+    if (size == PAGESIZE && tc->sse)
+        page_copy_sse(dst, src);
+    else
+        memcpy(dst, src, size);
+}
+
+/*
+ * Maps the pages of [va, va + len) that are not mapped yet in one go
+ * (with vmr_prefault), so that the loops below rarely have to fault pages in
+ * one by one.
+ * It also loads the kernel's page structure, since the loops below access
+ * the physical pages through the identity map.
+ */
+static void pt_prefault(uint32_t pmap_id, uintptr_t va, size_t len)
+{
+    uintptr_t start = rounddown(va, PAGESIZE);
+    uintptr_t end = roundup(va + len, PAGESIZE);
+
+    pdir_use_kern();
+    if (len != 0)
+        vmr_prefault(pmap_id, start, (end - start) / PAGESIZE);
+}
 
 size_t pt_copyin(uint32_t pmap_id, uintptr_t uva, void *kva, size_t len)
 {
@@ -25,21 +158,22 @@ size_t pt_copyin(uint32_t pmap_id, uintptr_t uva, void *kva, size_t len)
         return 0;
 
     size_t copied = 0;
+    struct pt_tcache tc;
 
-    while (len) {
-        uintptr_t uva_pa = get_ptbl_entry_by_va(pmap_id, uva);
+    pt_prefault(pmap_id, uva, len);
+    pt_tcache_init(&tc, pmap_id);
 
-        if ((uva_pa & PTE_P) == 0) {
-            alloc_page(pmap_id, uva, PTE_P | PTE_U | PTE_W);
-            uva_pa = get_ptbl_entry_by_va(pmap_id, uva);
-        }
+    while (len) {
+        uintptr_t uva_pa = pt_translate(&tc, uva, FALSE);
 
+        if ((uva_pa & PTE_P) == 0)
+            break;
         uva_pa = (uva_pa & 0xfffff000) + (uva % PAGESIZE);
 
         size_t size = (len < PAGESIZE - uva_pa % PAGESIZE) ?
             len : PAGESIZE - uva_pa % PAGESIZE;
 
-        memcpy(kva, (void *) uva_pa, size);
+        pt_memcpy(&tc, kva, (void *) uva_pa, size);
 
         len -= size;
         uva += size;
@@ -59,21 +193,22 @@ size_t pt_copyout(void *kva, uint32_t pmap_id, uintptr_t uva, size_t len)
         return 0;
 
     size_t copied = 0;
+    struct pt_tcache tc;
 
-    while (len) {
-        uintptr_t uva_pa = get_ptbl_entry_by_va(pmap_id, uva);
+    pt_prefault(pmap_id, uva, len);
+    pt_tcache_init(&tc, pmap_id);
 
-        if ((uva_pa & PTE_P) == 0) {
-            alloc_page(pmap_id, uva, PTE_P | PTE_U | PTE_W);
-            uva_pa = get_ptbl_entry_by_va(pmap_id, uva);
-        }
+    while (len) {
+        uintptr_t uva_pa = pt_translate(&tc, uva, TRUE);
 
+        if ((uva_pa & PTE_P) == 0)
+            break;
         uva_pa = (uva_pa & 0xfffff000) + (uva % PAGESIZE);
 
         size_t size = (len < PAGESIZE - uva_pa % PAGESIZE) ?
             len : PAGESIZE - uva_pa % PAGESIZE;
 
-        memcpy((void *) uva_pa, kva, size);
+        pt_memcpy(&tc, (void *) uva_pa, kva, size);
 
         len -= size;
         uva += size;
@@ -87,15 +222,16 @@ size_t pt_copyout(void *kva, uint32_t pmap_id, uintptr_t uva, size_t len)
 size_t pt_memset(uint32_t pmap_id, uintptr_t va, char c, size_t len)
 {
     size_t set = 0;
+    struct pt_tcache tc;
 
-    while (len) {
-        uintptr_t pa = get_ptbl_entry_by_va(pmap_id, va);
+    pt_prefault(pmap_id, va, len);
+    pt_tcache_init(&tc, pmap_id);
 
-        if ((pa & PTE_P) == 0) {
-            alloc_page(pmap_id, va, PTE_P | PTE_U | PTE_W);
-            pa = get_ptbl_entry_by_va(pmap_id, va);
-        }
+    while (len) {
+        uintptr_t pa = pt_translate(&tc, va, TRUE);
 
+        if ((pa & PTE_P) == 0)
+            break;
         pa = (pa & 0xfffff000) + (va % PAGESIZE);
 
         size_t size = (len < PAGESIZE - pa % PAGESIZE) ?
@@ -36,6 +36,13 @@ enum __syscall_nr {
     SYS_yield,      /* yield to another process */
     SYS_produce,
     SYS_consume,
+    SYS_getpid,     /* get the process ID of the caller */
+    SYS_fork,       /* create a copy-on-write copy of the caller */
+    SYS_fault_around, /* set the caller's fault-around window, get its fault counters */
+    SYS_mmap,       /* map anonymous memory */
+    SYS_munmap,     /* unmap memory */
+    SYS_exit,       /* terminate the caller */
+    SYS_wset,       /* get the working set estimates of a process */
 
     MAX_SYSCALL_NR  /* XXX: always put it at the end of __syscall_nr */
 };
@@ -73,6 +80,9 @@ enum __error_nr {
 #define DISK_READ  0
 #define DISK_WRITE 1
 
+#define MMAP_WRITE 0x1  /* the memory mapped by SYS_mmap is writable */
+#define MMAP_LARGE 0x2  /* and is mapped with 4MB pages where possible */
+
 typedef enum {
     GUEST_EAX, GUEST_EBX, GUEST_ECX, GUEST_EDX, GUEST_ESI, GUEST_EDI,
     GUEST_EBP, GUEST_ESP, GUEST_EIP, GUEST_EFLAGS,
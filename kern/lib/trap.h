@@ -4,6 +4,7 @@
 #ifdef _KERN_
 
 #define PFE_PR        0x1         /* Page fault caused by protection violation */
+#define PFE_WR        0x2         /* Page fault caused by a write */
 #define CPU_GDT_UCODE 0x18        /* user text */
 #define CPU_GDT_UDATA 0x20        /* user data */
 #define VM_USERHI     0xf0000000
@@ -0,0 +1,505 @@
+#include <lib/debug.h>
+#include <lib/string.h>
+#include <lib/spinlock.h>
+#include <lib/types.h>
+#include <lib/x86.h>
+#include <lib/vmregion.h>
+#include <pmm/MATIntro/export.h>
+#include <pmm/MContainer/export.h>
+#include <vmm/MPTIntro/export.h>
+#include <vmm/MPTOp/export.h>
+#include <vmm/MPTKern/export.h>
+#include <vmm/MPTNew/export.h>
+
+#define VM_USERHI 0xf0000000
+#define VM_USERLO 0x40000000
+
+// The stack region every process starts with, right below VM_USERHI.
+#define VM_STACKLO (VM_USERHI - VMR_STACK_SIZE)
+// Where vmr_mmap looks for free space when it is not given an address.
+#define VM_MMAPLO  0x80000000
+
+// The size of a 4MB page, in bytes and in 4KB pages.
+#define VMR_LARGE_SIZE  (PAGESIZE * 1024)
+#define VMR_LARGE_PAGES 1024
+
+static struct vm_region vm_regions[NUM_IDS][VMR_MAX];
+
+/*
+ * The fault-around window of each process: a page fault maps the unmapped
+ * pages of the aligned block of vmr_windows[pid] pages that contains the
+ * faulting page, within the same page table, and as long as the container of
+ * the process has quota left. A window of 1 maps only the faulting page.
+ */
+#define VMR_WINDOW_DEFAULT 8
+#define VMR_WINDOW_MAX     1024
+
+static uint32_t vmr_windows[NUM_IDS];
+
+// The number of page faults taken and pages mapped by them, per process, and
+// how many of the pages filled on a fault were taken pre-zeroed.
+static uint32_t vmr_nfaults[NUM_IDS];
+static uint32_t vmr_npages[NUM_IDS];
+static uint32_t vmr_nprezeroed[NUM_IDS];
+
+// Serializes the filling of the shared pages of the regions.
+static spinlock_t vmr_shared_lk;
+
+void vmregion_init(void)
+{
+    uint32_t pid;
+
+    spinlock_init(&vmr_shared_lk);
+    memzero(vm_regions, sizeof(vm_regions));
+    memzero(vmr_nfaults, sizeof(vmr_nfaults));
+    memzero(vmr_npages, sizeof(vmr_npages));
+    memzero(vmr_nprezeroed, sizeof(vmr_nprezeroed));
+    for (pid = 0; pid < NUM_IDS; pid++)
+        vmr_windows[pid] = VMR_WINDOW_DEFAULT;
+}
+
+/*
+ * Drops the regions and the fault counters of process pid, for a new process,
+ * which is left with the anonymous stack region only and the default
+ * fault-around window.
+ */
+void vmr_init(uint32_t pid)
+{
+    memzero(vm_regions[pid], sizeof(vm_regions[pid]));
+    vmr_nfaults[pid] = 0;
+    vmr_npages[pid] = 0;
+    vmr_nprezeroed[pid] = 0;
+    vmr_windows[pid] = VMR_WINDOW_DEFAULT;
+    vmr_add(pid, VM_STACKLO, VM_USERHI, PTE_P | PTE_U | PTE_W, 0, 0, 0, NULL);
+}
+
+/*
+ * Registers the region [start, end) of process pid.
+ * Returns 0, or -1 if the process has no free region slot.
+ */
+int vmr_add(uint32_t pid, uint32_t start, uint32_t end, uint32_t perm,
+            uintptr_t file, uint32_t file_va, uint32_t file_end,
+            uint32_t *shared)
+{
+    struct vm_region *r;
+    int i;
+
+    KERN_ASSERT(start % PAGESIZE == 0 && end % PAGESIZE == 0 && start < end);
+
+    for (i = 0; i < VMR_MAX; i++) {
+        r = &vm_regions[pid][i];
+        if (r->end == 0) {
+            r->start = start;
+            r->end = end;
+            r->perm = perm;
+            r->file = file;
+            r->file_va = file_va;
+            r->file_end = file_end;
+            r->shared = shared;
+            r->large = FALSE;
+            return 0;
+        }
+    }
+
+    return -1;
+}
+
+// Returns the region of process pid that contains va, or NULL.
+struct vm_region *vmr_find(uint32_t pid, uint32_t va)
+{
+    struct vm_region *r;
+    int i;
+
+    for (i = 0; i < VMR_MAX; i++) {
+        r = &vm_regions[pid][i];
+        if (r->start <= va && va < r->end)
+            return r;
+    }
+
+    return NULL;
+}
+
+// Returns a region of process pid that overlaps [start, end), or NULL.
+static struct vm_region *vmr_overlap(uint32_t pid, uint32_t start, uint32_t end)
+{
+    struct vm_region *r;
+    int i;
+
+    for (i = 0; i < VMR_MAX; i++) {
+        r = &vm_regions[pid][i];
+        if (r->end != 0 && r->start < end && start < r->end)
+            return r;
+    }
+
+    return NULL;
+}
+
+// The child of a fork inherits the regions and the fault-around window of its parent.
+void vmr_copy(uint32_t from, uint32_t to)
+{
+    memcpy(vm_regions[to], vm_regions[from], sizeof(vm_regions[to]));
+    vmr_windows[to] = min(vmr_windows[from], max(container_get_quota(to), 1));
+    vmr_nfaults[to] = 0;
+    vmr_npages[to] = 0;
+    vmr_nprezeroed[to] = 0;
+}
+
+/*
+ * Allocates a page for the page aligned address va of region r, charged to
+ * process pid, and fills it: the file backed part is copied from the image
+ * and the rest is zeroed. A pre-zeroed page is used if there is one, and is
+ * counted in vmr_nprezeroed. Returns the page index, or 0 on failure.
+ * The kernel's page structure must be loaded (see vmr_fault).
+ */
+static uint32_t vmr_fill(uint32_t pid, struct vm_region *r, uint32_t va)
+{
+    uint32_t page, from, to;
+
+    page = container_alloc_prezeroed(pid);
+    if (page != 0) {
+        vmr_nprezeroed[pid]++;
+    } else {
+        page = container_alloc_zeroed(pid);
+        if (page == 0)
+            return 0;
+    }
+
+    from = max(va, r->file_va);
+    to = min(va + PAGESIZE, r->file_end);
+    if (r->file != 0 && from < to) {
+        memcpy((void *) (page * PAGESIZE + from - va),
+               (void *) (r->file + from - r->file_va), to - from);
+    }
+
+    return page;
+}
+
+/*
+ * Maps the 4MB aligned slot [va, va + VMR_LARGE_SIZE) of process pid, which
+ * has no page table yet, with a zeroed 4MB page taken from the container.
+ * Returns 0, or MagicNumber if there is not enough quota or contiguous memory.
+ * The kernel's page structure must be loaded (see vmr_fault).
+ */
+static uint32_t vmr_fill_large(uint32_t pid, struct vm_region *r, uint32_t va)
+{
+    uint32_t page;
+
+    page = container_alloc_contig(pid, VMR_LARGE_PAGES, VMR_LARGE_PAGES);
+    if (page == 0)
+        return MagicNumber;
+
+    memzero((void *) (page * PAGESIZE), VMR_LARGE_SIZE);
+
+    if (map_large_page(pid, va, page, r->perm) == MagicNumber) {
+        container_free_contig(pid, page, VMR_LARGE_PAGES);
+        return MagicNumber;
+    }
+    return 0;
+}
+
+/*
+ * Maps a page for the address va of process pid, which is not mapped yet.
+ * The page is filled from the region of va (or taken from its shared pages).
+ * In a region with large pages, the whole 4MB slot of va is mapped at once
+ * if it lies in the region and has no page table yet.
+ * Returns 0, or MagicNumber if va is in no region or in the case of error.
+ */
+uint32_t vmr_fault(uint32_t pid, uint32_t va)
+{
+    struct vm_region *r;
+    uint32_t page, idx, slot, perm;
+
+    va = rounddown(va, PAGESIZE);
+    r = vmr_find(pid, va);
+
+    if (r == NULL)
+        return MagicNumber;
+
+    // The pages are allocated and filled through the identity map.
+    pdir_use_kern();
+
+    if (r->large) {
+        slot = rounddown(va, VMR_LARGE_SIZE);
+        if (r->start <= slot && slot + VMR_LARGE_SIZE <= r->end &&
+            get_pdir_entry_by_va(pid, slot) == 0 &&
+            vmr_fill_large(pid, r, slot) == 0)
+            return 0;
+    }
+
+    if (r->shared == NULL) {
+        page = vmr_fill(pid, r, va);
+        if (page == 0)
+            return MagicNumber;
+        if (map_page(pid, va, page, r->perm) == MagicNumber) {
+            container_free(pid, page);
+            return MagicNumber;
+        }
+        return 0;
+    }
+
+    // Indexed from the segment, since the start of r may have been unmapped.
+    idx = (va - rounddown(r->file_va, PAGESIZE)) / PAGESIZE;
+    spinlock_acquire(&vmr_shared_lk);
+    page = r->shared[idx];
+    if (page == 0) {
+        // The first process to touch the page fills it, and pays for it.
+        page = vmr_fill(pid, r, va);
+        if (page != 0) {
+            at_inc_ref(page);  // the reference of the shared pages
+            r->shared[idx] = page;
+        }
+    } else if (container_share(pid, page) == 0) {
+        page = 0;
+    }
+    spinlock_release(&vmr_shared_lk);
+
+    if (page == 0)
+        return MagicNumber;
+    // Only the writable shared pages are copied on the first write (as in
+    // pdir_copy_cow); the others stay read-only.
+    perm = (r->perm & PTE_W) ? (r->perm & ~PTE_W) | PTE_COW : r->perm;
+    if (map_page(pid, va, page, perm) == MagicNumber) {
+        container_free(pid, page);
+        return MagicNumber;
+    }
+    return 0;
+}
+
+/*
+ * Maps the pages of [va, va + npages * PAGESIZE) that are not mapped yet and
+ * belong to a region: the pages of anonymous regions are allocated zeroed in
+ * batches (with alloc_pages), and the others are filled one by one (or 4MB at
+ * a time, in regions with large pages).
+ */
+void vmr_prefault(uint32_t pid, uint32_t va, uint32_t npages)
+{
+    uint32_t end = va + npages * PAGESIZE;
+    uint32_t from, to;
+    struct vm_region *r;
+    int i;
+
+    for (i = 0; i < VMR_MAX; i++) {
+        r = &vm_regions[pid][i];
+        from = max(va, r->start);
+        to = min(end, r->end);
+        if (from >= to)
+            continue;
+        if (r->file == 0 && r->shared == NULL && !r->large) {
+            alloc_pages(pid, from, (to - from) / PAGESIZE, r->perm);
+            continue;
+        }
+        for (; from < to; from += PAGESIZE) {
+            if ((get_ptbl_entry_by_va(pid, from) & PTE_P) == 0)
+                vmr_fault(pid, from);
+        }
+    }
+}
+
+/*
+ * Handles a page fault of process pid at va on an unmapped page: maps the
+ * faulting page, and then the other unmapped pages of its fault-around window
+ * that belong to the same region.
+ * The window stops at the first page that cannot be allocated, and never
+ * takes the last page of the quota, which is left for a page table.
+ * Returns 0, or MagicNumber if the faulting page itself cannot be mapped.
+ */
+uint32_t vmr_pgflt(uint32_t pid, uint32_t va)
+{
+    struct vm_region *r;
+    uint32_t window = vmr_windows[pid];
+    uint32_t start, end, avail, quota, usage, page;
+
+    va = rounddown(va, PAGESIZE);
+    vmr_nfaults[pid]++;
+
+    if (vmr_fault(pid, va) == MagicNumber)
+        return MagicNumber;
+
+    if (get_pdir_entry_by_va(pid, va) & PTE_PS) {
+        vmr_npages[pid] += VMR_LARGE_PAGES;
+        return 0;
+    }
+    vmr_npages[pid]++;
+
+    if (window <= 1)
+        return 0;
+
+    r = vmr_find(pid, va);
+    start = rounddown(va, window * PAGESIZE);
+    end = start + window * PAGESIZE;
+    // The same page table.
+    start = max(start, rounddown(va, PAGESIZE * 1024));
+    end = min(end, rounddown(va, PAGESIZE * 1024) + PAGESIZE * 1024);
+    start = max(start, r->start);
+    end = min(end, r->end);
+
+    quota = container_get_quota(pid);
+    usage = container_get_usage(pid);
+    avail = quota > usage + 1 ? quota - usage - 1 : 0;
+
+    for (page = start; page < end && avail > 0; page += PAGESIZE) {
+        if (page == va || (get_ptbl_entry_by_va(pid, page) & PTE_P))
+            continue;
+        if (vmr_fault(pid, page) == MagicNumber)
+            break;
+        vmr_npages[pid]++;
+        avail--;
+    }
+
+    return 0;
+}
+
+/*
+ * Adds an anonymous region of [len] bytes (rounded up to pages) with the
+ * permission [perm] to process pid: at the page aligned address [va] if it is
+ * not 0, or else at the lowest free range from VM_MMAPLO (4MB aligned if the
+ * region is [large]). The pages are allocated zeroed when they are first
+ * touched, 4MB at a time if the region is [large].
+ * Returns the start of the region, or 0 if the range is taken or there is no
+ * room for it.
+ */
+uint32_t vmr_mmap(uint32_t pid, uint32_t va, uint32_t len, uint32_t perm,
+                  bool large)
+{
+    struct vm_region *r;
+    uint32_t size, align;
+
+    if (len == 0 || len > VM_USERHI - VM_USERLO || va % PAGESIZE != 0)
+        return 0;
+    size = roundup(len, PAGESIZE);
+
+    if (va != 0) {
+        if (va < VM_USERLO || va > VM_USERHI - size ||
+            vmr_overlap(pid, va, va + size) != NULL)
+            return 0;
+    } else {
+        // First fit: skips past the regions in the way.
+        align = large ? VMR_LARGE_SIZE : PAGESIZE;
+        va = VM_MMAPLO;
+        while (va <= VM_USERHI - size &&
+               (r = vmr_overlap(pid, va, va + size)) != NULL)
+            va = roundup(r->end, align);
+        if (va > VM_USERHI - size)
+            return 0;
+    }
+
+    if (vmr_add(pid, va, va + size, perm, 0, 0, 0, NULL) != 0)
+        return 0;
+    vmr_find(pid, va)->large = large;
+
+    return va;
+}
+
+/*
+ * Removes [va, va + len) (rounded up to pages) from the regions of process
+ * pid: the mapped pages in it are unmapped and given back to the container of
+ * the process, and the regions are trimmed, split or dropped accordingly.
+ * The 4MB pages that are only partly in the range are split first.
+ * Returns the number of pages given back, or -1 if va is not page aligned,
+ * a region would have to be split and there is no free slot for it, or a 4MB
+ * page cannot be split.
+ */
+int vmr_munmap(uint32_t pid, uint32_t va, uint32_t len)
+{
+    uint32_t pages[VMR_UNMAP_BATCH];
+    uint32_t end, from, to, n, nr_rmv, nfree, page;
+    struct vm_region *r, *slot;
+    int i;
+
+    if (va % PAGESIZE != 0 || va < VM_USERLO || va >= VM_USERHI)
+        return -1;
+    end = len > VM_USERHI - va ? VM_USERHI : roundup(va + len, PAGESIZE);
+
+    // Makes sure the regions can be updated before anything is unmapped.
+    slot = NULL;
+    for (i = 0; i < VMR_MAX; i++) {
+        r = &vm_regions[pid][i];
+        if (r->end == 0 && slot == NULL)
+            slot = r;
+    }
+    for (i = 0; i < VMR_MAX; i++) {
+        r = &vm_regions[pid][i];
+        if (r->end != 0 && r->start < va && end < r->end && slot == NULL)
+            return -1;
+    }
+
+    if ((va % VMR_LARGE_SIZE != 0 && split_large_page(pid, va) == MagicNumber) ||
+        (end % VMR_LARGE_SIZE != 0 && split_large_page(pid, end) == MagicNumber))
+        return -1;
+
+    pdir_use_kern();
+    nfree = 0;
+    for (from = va; from < end; from = to) {
+        to = min(end, rounddown(from, VMR_LARGE_SIZE) + VMR_LARGE_SIZE);
+        page = unmap_large_page(pid, from);
+        if (page != 0) {
+            container_free_contig(pid, page, VMR_LARGE_PAGES);
+            nfree += VMR_LARGE_PAGES;
+            continue;
+        }
+        for (; from < to; from += n * PAGESIZE) {
+            n = min((to - from) / PAGESIZE, VMR_UNMAP_BATCH);
+            nr_rmv = unmap_range(pid, from, n, pages);
+            container_free_batch(pid, pages, nr_rmv);
+            nfree += nr_rmv;
+        }
+    }
+
+    for (i = 0; i < VMR_MAX; i++) {
+        r = &vm_regions[pid][i];
+        if (r->end == 0 || r->end <= va || end <= r->start)
+            continue;
+        from = r->start;
+        to = r->end;
+        if (va <= from && to <= end) {
+            r->end = 0;
+            r->start = 0;
+        } else if (va <= from) {
+            r->start = end;
+        } else if (to <= end) {
+            r->end = va;
+        } else {
+            // Splits r around the hole, the upper part in the free slot.
+            *slot = *r;
+            slot->start = end;
+            r->end = va;
+        }
+    }
+
+    return nfree;
+}
+
+/*
+ * Sets the fault-around window of process pid to [window] pages, but no more
+ * than VMR_WINDOW_MAX or the quota of the process, and returns the previous one.
+ */
+uint32_t vmr_set_window(uint32_t pid, uint32_t window)
+{
+    uint32_t old = vmr_windows[pid];
+
+    window = min(window, min(container_get_quota(pid), VMR_WINDOW_MAX));
+    vmr_windows[pid] = max(window, 1);
+    return old;
+}
+
+uint32_t vmr_get_window(uint32_t pid)
+{
+    return vmr_windows[pid];
+}
+
+// The number of page faults taken by process pid, and of pages they mapped.
+uint32_t vmr_get_nfaults(uint32_t pid)
+{
+    return vmr_nfaults[pid];
+}
+
+uint32_t vmr_get_npages(uint32_t pid)
+{
+    return vmr_npages[pid];
+}
+
+// The number of pages filled on a fault of process pid that were pre-zeroed.
+uint32_t vmr_get_nprezeroed(uint32_t pid)
+{
+    return vmr_nprezeroed[pid];
+}
@@ -0,0 +1,61 @@
+#ifndef _KERN_LIB_VMREGION_H_
+#define _KERN_LIB_VMREGION_H_
+
+#ifdef _KERN_
+
+#include <lib/types.h>
+
+/*
+ * The regions of the user address space of a process that are filled on
+ * demand, when they are first touched, instead of when the process is
+ * created. A region is backed by the part [file_va, file_end) that is copied
+ * from the kernel address [file], and the rest of it is zeroed.
+ */
+#define VMR_MAX 16  /* the maximum number of regions of a process */
+
+#define VMR_STACK_SIZE  0x400000  /* the stack region of a process, 4MB */
+#define VMR_UNMAP_BATCH 64  /* the number of pages vmr_munmap frees at once */
+
+struct vm_region {
+    uint32_t start;     /* page aligned start of the region */
+    uint32_t end;       /* page aligned end of the region, 0 if unused */
+    uint32_t perm;      /* the permission of the mapped pages */
+    uintptr_t file;     /* the data backing file_va, 0 for anonymous memory */
+    uint32_t file_va;
+    uint32_t file_end;
+    /*
+     * If not NULL, one physical page per page of the region, shared by all
+     * processes that map the region (0 until the first of them touches it).
+     * The pages are mapped read-only and copy-on-write.
+     */
+    uint32_t *shared;
+    /*
+     * Whether the 4MB slots that lie entirely in the (anonymous) region are
+     * mapped with 4MB pages, falling back to 4KB pages when no contiguous
+     * 4MB of memory is available.
+     */
+    bool large;
+};
+
+void vmregion_init(void);
+void vmr_init(uint32_t pid);
+int vmr_add(uint32_t pid, uint32_t start, uint32_t end, uint32_t perm,
+            uintptr_t file, uint32_t file_va, uint32_t file_end,
+            uint32_t *shared);
+struct vm_region *vmr_find(uint32_t pid, uint32_t va);
+void vmr_copy(uint32_t from, uint32_t to);
+uint32_t vmr_fault(uint32_t pid, uint32_t va);
+void vmr_prefault(uint32_t pid, uint32_t va, uint32_t npages);
+uint32_t vmr_pgflt(uint32_t pid, uint32_t va);
+uint32_t vmr_mmap(uint32_t pid, uint32_t va, uint32_t len, uint32_t perm,
+                  bool large);
+int vmr_munmap(uint32_t pid, uint32_t va, uint32_t len);
+uint32_t vmr_set_window(uint32_t pid, uint32_t window);
+uint32_t vmr_get_window(uint32_t pid);
+uint32_t vmr_get_nfaults(uint32_t pid);
+uint32_t vmr_get_npages(uint32_t pid);
+uint32_t vmr_get_nprezeroed(uint32_t pid);
+
+#endif  /* _KERN_ */
+
+#endif  /* !_KERN_LIB_VMREGION_H_ */
@@ -0,0 +1,60 @@
+#include <lib/string.h>
+#include <lib/types.h>
+#include <lib/x86.h>
+#include <lib/wset.h>
+#include <pcpu/PCPUIntro/export.h>
+#include <vmm/MPTKern/export.h>
+
+static struct wset wsets[NUM_IDS];
+
+// The timer ticks of each CPU since its last scan.
+static uint32_t wset_ticks[NUM_CPUS];
+
+void wset_init(void)
+{
+    memzero(wsets, sizeof(wsets));
+    memzero(wset_ticks, sizeof(wset_ticks));
+}
+
+// Drops the estimates of process pid, for a new process.
+void wset_reset(uint32_t pid)
+{
+    memzero(&wsets[pid], sizeof(wsets[pid]));
+}
+
+/*
+ * Samples and clears the accessed and dirty bits of the pages of process pid,
+ * and updates its estimates. The moving average weighs the last period by 1/4.
+ * It has to run on the CPU of the process, or while the process is not running.
+ */
+void wset_scan(uint32_t pid)
+{
+    struct wset *ws = &wsets[pid];
+    uint32_t accessed, dirty, hot;
+
+    ws->resident = pdir_scan_ad(pid, &accessed, &dirty, &hot);
+    ws->accessed = accessed;
+    ws->dirty = dirty;
+    ws->hot = hot;
+    ws->avg = ws->scans == 0 ? accessed : (ws->avg * 3 + accessed) / 4;
+    ws->peak = max(ws->peak, accessed);
+    ws->scans++;
+}
+
+// Called on each timer tick of the current CPU, with the running process pid.
+void wset_tick(uint32_t pid)
+{
+    uint32_t cpu_idx = get_pcpu_idx();
+
+    if (++wset_ticks[cpu_idx] < WSET_PERIOD)
+        return;
+
+    wset_ticks[cpu_idx] = 0;
+    if (pid != 0)
+        wset_scan(pid);
+}
+
+void wset_get(uint32_t pid, struct wset *ws)
+{
+    *ws = wsets[pid];
+}
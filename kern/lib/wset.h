@@ -0,0 +1,33 @@
+#ifndef _KERN_LIB_WSET_H_
+#define _KERN_LIB_WSET_H_
+
+#ifdef _KERN_
+
+#include <lib/types.h>
+
+/*
+ * The working set of a process, estimated from the accessed and dirty bits of
+ * its pages, which are sampled and cleared by each scan. The running process
+ * is scanned every WSET_PERIOD timer ticks of its CPU. All sizes are in pages.
+ */
+#define WSET_PERIOD 100
+
+struct wset {
+    uint32_t scans;     /* the number of scans so far */
+    uint32_t resident;  /* the pages mapped at the last scan */
+    uint32_t accessed;  /* the pages accessed between the last two scans */
+    uint32_t dirty;     /* the pages written between the last two scans */
+    uint32_t hot;       /* the pages accessed in both of the last two periods */
+    uint32_t avg;       /* the moving average of accessed */
+    uint32_t peak;      /* the largest accessed so far */
+};
+
+void wset_init(void);
+void wset_reset(uint32_t pid);
+void wset_scan(uint32_t pid);
+void wset_tick(uint32_t pid);
+void wset_get(uint32_t pid, struct wset *ws);
+
+#endif  /* _KERN_ */
+
+#endif  /* !_KERN_LIB_WSET_H_ */
@@ -219,6 +219,30 @@ gcc_inline uint32_t rcr4(void)
     return cr4;
 }
 
+// Invalidates the TLB entry of the page containing [va], even a global one.
+gcc_inline void invlpg(uintptr_t va)
+{
+    __asm __volatile ("invlpg (%0)" :: "r" (va) : "memory");
+}
+
+/**
+ * Flushes the whole TLB of the current CPU, including the global entries,
+ * which survive the reload of CR3. Toggling CR4.PGE flushes them (Sec 4.10.4.1,
+ * Intel ASDM Vol3). The other CPUs are flushed through their TLB queues
+ * (see tlb_shootdown_kern).
+ */
+gcc_inline void tlb_flush_global(void)
+{
+    uint32_t cr4 = rcr4();
+
+    if (cr4 & CR4_PGE) {
+        lcr4(cr4 & ~CR4_PGE);
+        lcr4(cr4);
+    } else {
+        lcr3(rcr3());
+    }
+}
+
 gcc_inline uint8_t inb(int port)
 {
     uint8_t data;
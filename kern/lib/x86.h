@@ -77,6 +77,7 @@
 #define CR0_PG 0x80000000  /* Paging */
 
 /* CR4 */
+#define CR4_PSE        0x00000010  /* Page Size Extensions */
 #define CR4_PGE        0x00000080  /* Page Global Enable */
 #define CR4_OSFXSR     0x00000200  /* SSE and FXSAVE/FXRSTOR enable */
 #define CR4_OSXMMEXCPT 0x00000400  /* Unmasked SSE FP exceptions */
@@ -101,13 +102,14 @@
 #define PTE_D    0x040  /* Dirty */
 #define PTE_PS   0x080  /* Page Size */
 #define PTE_G    0x100  /* Global */
+#define PTE_HOT  0x400  /* Avail: accessed before the last working-set scan */
 #define PTE_COW  0x800  /* Avail for system programmer's use */
 
 /* other constants */
 #define NUM_CPUS 8
 #define NUM_IDS 64
 #define MagicNumber 1048577
-#define MAX_CHILDREN 3
+#define MAX_ORDER 10  /* largest buddy block: 2^MAX_ORDER pages (4MB) */
 
 uintptr_t read_esp(void);
 uint32_t read_ebp(void);
@@ -138,6 +140,8 @@ uint32_t rcr2(void);
 void lcr3(uint32_t val);
 void lcr4(uint32_t val);
 uint32_t rcr4(void);
+void invlpg(uintptr_t va);
+void tlb_flush_global(void);
 uint8_t inb(int port);
 void insl(int port, void *addr, int cnt);
 void outb(int port, uint8_t data);
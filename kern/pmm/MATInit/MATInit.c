@@ -1,5 +1,6 @@
 #include <lib/debug.h>
 #include <lib/types.h>
+#include <lib/x86.h>
 #include "import.h"
 
 #define PAGESIZE     4096
@@ -14,26 +15,26 @@
  * 1. Calculate the actual physical memory of the machine, and sets the number
  *    of physical pages (NUM_PAGES).
  * 2. Initializes the physical allocation table (AT) implemented in the MATIntro layer
- *    based on the information available in the physical memory map table.
- *    Review import.h in the current directory for the list of available
- *    getter and setter functions.
+ *    based on the information available in the physical memory map table, and
+ *    sets the number of pages with the normal permission (NUM_NORM).
  */
 void pmem_init(unsigned int mbi_addr)
 {
-    unsigned int nps;
-    unsigned int pg_idx, pmmap_size, cur_addr, highest_addr;
-    unsigned int entry_idx, flag, isnorm, start, len;
+    unsigned int nps, nnorm, user_hi;
+    unsigned int pmmap_size, cur_addr, entry_idx;
+    unsigned int start, end, from, to, cursor;
+    unsigned long long tsc_start, tsc_end;
 
     // Calls the lower layer initialization primitive.
     // The parameter mbi_addr should not be used in the further code.
     devinit(mbi_addr);
     mem_spinlock_init();
 
+    tsc_start = rdtsc();
+
     /**
-     * Calculate the total number of physical pages provided by the hardware and
-     * store it into the local variable nps.
-     * Hint: Think of it as the highest address in the ranges of the memory map table,
-     *       divided by the page size.
+     * The total number of physical pages is the highest address in the ranges
+     * of the memory map table, divided by the page size.
      */
     nps = 0;
     entry_idx = 0;
@@ -54,48 +55,69 @@ void pmem_init(unsigned int mbi_addr)
      *
      * In CertiKOS, all addresses < VM_USERLO or >= VM_USERHI are reserved by the kernel.
      * That corresponds to the physical pages from 0 to VM_USERLO_PI - 1,
-     * and from VM_USERHI_PI to NUM_PAGES - 1.
+     * and from VM_USERHI_PI to NUM_PAGES - 1. They get the permission 1.
      * The rest of the pages that correspond to addresses [VM_USERLO, VM_USERHI)
-     * can be used freely ONLY IF the entire page falls into one of the ranges in
-     * the memory map table with the permission marked as usable.
+     * can be used freely (permission 2) ONLY IF the entire page falls into one of
+     * the ranges in the memory map table with the permission marked as usable.
+     * Otherwise, they get the permission 0.
      *
-     * Hint:
-     * 1. You have to initialize AT for all the page indices from 0 to NPS - 1.
-     * 2. For the pages that are reserved by the kernel, simply set its permission to 1.
-     *    Recall that the setter at_set_perm also marks the page as unallocated.
-     *    Thus, you don't have to call another function to set the allocation flag.
-     * 3. For the rest of the pages, explore the memory map table to set its permission
-     *    accordingly. The permission should be set to 2 only if there is a range
-     *    containing the entire page that is marked as available in the memory map table.
-     *    Otherwise, it should be set to 0. Note that the ranges in the memory map are
-     *    not aligned by pages, so it may be possible that for some pages, only some of
-     *    the addresses are in a usable range. Currently, we do not utilize partial pages,
-     *    so in that case, you should consider those pages as unavailable.
+     * Instead of searching the memory map for every page, the table is filled
+     * range by range: all the user pages start as reserved, then the usable
+     * ranges are swept in their sorted order and their whole pages become
+     * normal. Pages that also lie entirely within a reserved range are taken
+     * back afterwards. The number of normal pages is counted along the way.
      */
-    pg_idx = 0;
-    while (pg_idx < nps) {
-        if (pg_idx < VM_USERLO_PI || VM_USERHI_PI <= pg_idx) {
-            at_set_perm(pg_idx, 1);
-        } else {
-            entry_idx = 0;
-            flag = 0;
-            isnorm = 0;
-            while (entry_idx < pmmap_size && !flag) {
-                isnorm = is_usable(entry_idx);
-                start = get_mms(entry_idx);
-                len = get_mml(entry_idx);
-                if (start <= pg_idx * PAGESIZE && (pg_idx + 1) * PAGESIZE <= start + len) {
-                    flag = 1;
-                }
-                entry_idx++;
-            }
+    user_hi = nps < VM_USERHI_PI ? nps : VM_USERHI_PI;
+
+    at_set_perm_range(0, VM_USERLO_PI < nps ? VM_USERLO_PI : nps, 1);
+    at_set_perm_range(VM_USERHI_PI, nps, 1);
+    at_set_perm_range(VM_USERLO_PI, user_hi, 0);
 
-            if (flag && isnorm) {
-                at_set_perm(pg_idx, 2);
-            } else {
-                at_set_perm(pg_idx, 0);
-            }
+    nnorm = 0;
+    cursor = VM_USERLO_PI;
+    for (entry_idx = 0; entry_idx < pmmap_size; entry_idx++) {
+        if (!is_usable(entry_idx)) {
+            continue;
+        }
+        start = get_mms(entry_idx);
+        end = start + get_mml(entry_idx);
+        from = start / PAGESIZE + (start % PAGESIZE != 0);
+        to = ROUNDDOWN(end, PAGESIZE) / PAGESIZE;
+        // Entries are sorted by the start address; skip what is already covered.
+        if (from < cursor) {
+            from = cursor;
+        }
+        if (to > user_hi) {
+            to = user_hi;
+        }
+        if (from < to) {
+            nnorm += (to - from) - at_set_perm_range(from, to, 2);
+            cursor = to;
         }
-        pg_idx++;
     }
+
+    for (entry_idx = 0; entry_idx < pmmap_size; entry_idx++) {
+        if (is_usable(entry_idx)) {
+            continue;
+        }
+        start = get_mms(entry_idx);
+        end = start + get_mml(entry_idx);
+        from = start / PAGESIZE + (start % PAGESIZE != 0);
+        to = ROUNDDOWN(end, PAGESIZE) / PAGESIZE;
+        if (from < VM_USERLO_PI) {
+            from = VM_USERLO_PI;
+        }
+        if (to > user_hi) {
+            to = user_hi;
+        }
+        if (from < to) {
+            nnorm -= at_set_perm_range(from, to, 0);
+        }
+    }
+
+    set_nnorm(nnorm);
+
+    tsc_end = rdtsc();
+    KERN_INFO("[TSC] pmem_init: %d pages, %d normal, %llu cycles.\n",
+              nps, nnorm, tsc_end - tsc_start);
 }
@@ -12,8 +12,13 @@ void mem_unlock(void);
 
 // Sets the number of available pages.
 void set_nps(unsigned int nps);
+// Sets the number of pages with the normal permission.
+void set_nnorm(unsigned int nnorm);
 // Sets the permission of the physical page with given index.
 void at_set_perm(unsigned int page_index, unsigned int perm);
+// Sets the permission of all the pages in [from, to).
+// Returns the number of those pages that had the normal permission before.
+unsigned int at_set_perm_range(unsigned int from, unsigned int to, unsigned int perm);
 
 /**
  * Getter and setter functions for the physical memory map table.
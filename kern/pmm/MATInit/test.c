@@ -30,6 +30,21 @@ int MATInit_test1()
     return 0;
 }
 
+int MATInit_test2()
+{
+    unsigned int i, nnorm = 0;
+    unsigned int nps = get_nps();
+    for (i = 0; i < nps; i++) {
+        nnorm += at_is_norm(i);
+    }
+    if (nnorm != get_nnorm()) {
+        dprintf("test 2.1 failed: (%d != %d)\n", nnorm, get_nnorm());
+        return 1;
+    }
+    dprintf("test 2 passed.\n");
+    return 0;
+}
+
 /**
  * Write Your Own Test Script (optional)
  *
@@ -52,5 +67,5 @@ int MATInit_test_own()
 
 int test_MATInit()
 {
-    return MATInit_test1() + MATInit_test_own();
+    return MATInit_test1() + MATInit_test2() + MATInit_test_own();
 }
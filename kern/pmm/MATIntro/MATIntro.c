@@ -1,36 +1,124 @@
+#include <lib/debug.h>
 #include <lib/gcc.h>
 #include <lib/spinlock.h>
+#include <lib/x86.h>
+#include <dev/mboot.h>
 
 static spinlock_t mem_lk;
 
 // Number of physical pages that are actually available in the machine.
 static unsigned int NUM_PAGES;
 
-/**
- * Structure representing information for one physical page.
- */
-struct ATStruct {
-    /**
-     * The permission of the page.
-     * 0: Reserved by the BIOS.
-     * 1: Kernel only.
-     * >1: Normal (available).
-     */
-    unsigned int perm;
-    /**
-     * Whether the page is allocated.
-     * 0: unallocated
-     * >0: allocated
-     */
-    unsigned int allocated;
-};
+// Number of physical pages with the normal permission.
+static unsigned int NUM_NORM;
 
 /**
+ * The physical allocation table (AT), kept as bitmaps with one bit per page
+ * so that a single 32 bit word covers 32 pages.
+ *
+ * The permission of a page takes two bits:
+ * - AT_NORM: the page has the normal permission (perm > 1), i.e., it is available.
+ * - AT_KERN: the page is kernel only (perm == 1).
+ * A page with neither bit set is reserved by the BIOS (perm == 0).
+ *
+ * AT_ALLOC has the bit of a page set if the page is allocated.
+ *
  * A 32 bit machine may have up to 4GB of memory.
  * So it may have up to 2^20 physical pages,
  * with the page size being 4KB.
+ *
+ * Each bitmap takes 128KB. With AT_FREE and the 16 bit reference counts
+ * (AT_REF, 2MB) below, the whole table takes 2.5MB of BSS, down from 8MB for
+ * the two 32 bit fields per page it used to have.
+ */
+#define AT_NWORDS ((1 << 20) / 32)
+
+static unsigned int AT_NORM[AT_NWORDS];
+static unsigned int AT_KERN[AT_NWORDS];
+static volatile unsigned int AT_ALLOC[AT_NWORDS];
+
+/**
+ * AT_FREE has the bit of a page set if the page is the first page of a block
+ * on one of the free lists of the buddy allocator.
  */
-static struct ATStruct AT[1 << 20];
+static unsigned int AT_FREE[AT_NWORDS];
+
+/**
+ * The number of references to each allocated page, e.g., the number of
+ * address spaces that map it.
+ */
+static volatile unsigned short AT_REF[1 << 20];
+
+/**
+ * The bookkeeping of a free block of the buddy allocator. A free block holds
+ * no data, so it is kept in the first page of the block itself, which the
+ * kernel reaches through the identity map. The table only needs the AT_FREE
+ * bit of the page to tell whether the page holds one.
+ * The buddy allocator must thus only be called with the kernel's page
+ * structure loaded (or before paging is turned on), which at_block checks on
+ * every access: with a process's page structure loaded, the address would
+ * hit the memory of the process instead.
+ */
+struct ATFreeBlock {
+    // The order of the free block, i.e., the block has 2^order pages.
+    unsigned int order;
+    // The previous and the next free block of the same order (0: none).
+    unsigned int prev;
+    unsigned int next;
+};
+
+static gcc_inline struct ATFreeBlock *at_block(unsigned int page_index)
+{
+    KERN_ASSERT(get_kern_cr3() == 0 || rcr3() == get_kern_cr3());
+    return (struct ATFreeBlock *) (page_index * PAGESIZE);
+}
+
+// The first free block of each order (0: the free list is empty).
+static unsigned int FREE_HEAD[MAX_ORDER + 1];
+
+/**
+ * Atomically sets or clears the bit of the given page in a bitmap.
+ * The allocation bits of cached pages are updated without the memory lock,
+ * so concurrent updates of the same word must not get lost.
+ */
+static gcc_inline void bitmap_set(volatile unsigned int *map, unsigned int page_index)
+{
+    asm volatile ("lock; btsl %1, %0"
+                  : "+m" (*map)
+                  : "r" (page_index)
+                  : "cc", "memory");
+}
+
+static gcc_inline void bitmap_clear(volatile unsigned int *map, unsigned int page_index)
+{
+    asm volatile ("lock; btrl %1, %0"
+                  : "+m" (*map)
+                  : "r" (page_index)
+                  : "cc", "memory");
+}
+
+// Returns the index of the least significant set bit of a non-zero word.
+static gcc_inline unsigned int bsf(unsigned int word)
+{
+    unsigned int idx;
+    asm ("bsfl %1, %0" : "=r" (idx) : "rm" (word) : "cc");
+    return idx;
+}
+
+// Returns the number of set bits in a word.
+static gcc_inline unsigned int popcount(unsigned int word)
+{
+    word = word - ((word >> 1) & 0x55555555);
+    word = (word & 0x33333333) + ((word >> 2) & 0x33333333);
+    word = (word + (word >> 4)) & 0x0F0F0F0F;
+    return (word * 0x01010101) >> 24;
+}
+
+// The bits of the pages in word [word] that are available and unallocated.
+static gcc_inline unsigned int free_bits(unsigned int word)
+{
+    return AT_NORM[word] & ~AT_ALLOC[word];
+}
 
 void mem_spinlock_init(void) {
     spinlock_init(&mem_lk);
@@ -56,6 +144,18 @@ void set_nps(unsigned int nps)
     NUM_PAGES = nps;
 }
 
+// The getter function for NUM_NORM.
+unsigned int get_nnorm(void)
+{
+    return NUM_NORM;
+}
+
+// The setter function for NUM_NORM.
+void set_nnorm(unsigned int nnorm)
+{
+    NUM_NORM = nnorm;
+}
+
 /**
  * The getter function for the page permission.
  * If the page with the given index has the normal permission,
@@ -63,16 +163,7 @@ void set_nps(unsigned int nps)
  */
 unsigned int at_is_norm(unsigned int page_index)
 {
-    unsigned int perm;
-
-    perm = AT[page_index].perm;
-    if (perm > 1) {
-        perm = 1;
-    } else {
-        perm = 0;
-    }
-
-    return perm;
+    return (AT_NORM[page_index / 32] >> (page_index % 32)) & 1;
 }
 
 /**
@@ -82,8 +173,65 @@ unsigned int at_is_norm(unsigned int page_index)
  */
 void at_set_perm(unsigned int page_index, unsigned int perm)
 {
-    AT[page_index].perm = perm;
-    AT[page_index].allocated = 0;
+    unsigned int bit = 1 << (page_index % 32);
+
+    if (perm > 1) {
+        AT_NORM[page_index / 32] |= bit;
+        AT_KERN[page_index / 32] &= ~bit;
+    } else if (perm == 1) {
+        AT_NORM[page_index / 32] &= ~bit;
+        AT_KERN[page_index / 32] |= bit;
+    } else {
+        AT_NORM[page_index / 32] &= ~bit;
+        AT_KERN[page_index / 32] &= ~bit;
+    }
+    bitmap_clear(AT_ALLOC, page_index);
+}
+
+/**
+ * Sets the permission of all the pages in [from, to) and marks them as
+ * unallocated, updating 32 pages per word. It is meant for initialization,
+ * when no page is allocated concurrently.
+ * Returns the number of pages in the range that had the normal permission
+ * before the call.
+ */
+unsigned int at_set_perm_range(unsigned int from, unsigned int to, unsigned int perm)
+{
+    unsigned int word, last, mask, nnorm;
+
+    if (from >= to) {
+        return 0;
+    }
+
+    word = from / 32;
+    last = (to - 1) / 32;
+    nnorm = 0;
+    while (word <= last) {
+        mask = 0xFFFFFFFF;
+        if (word == from / 32) {
+            mask &= 0xFFFFFFFF << (from % 32);
+        }
+        if (word == last && to % 32 != 0) {
+            mask &= 0xFFFFFFFF >> (32 - to % 32);
+        }
+
+        nnorm += popcount(AT_NORM[word] & mask);
+        if (perm > 1) {
+            AT_NORM[word] |= mask;
+            AT_KERN[word] &= ~mask;
+        } else if (perm == 1) {
+            AT_NORM[word] &= ~mask;
+            AT_KERN[word] |= mask;
+        } else {
+            AT_NORM[word] &= ~mask;
+            AT_KERN[word] &= ~mask;
+        }
+        AT_ALLOC[word] &= ~mask;
+
+        word++;
+    }
+
+    return nnorm;
 }
 
 /**
@@ -92,21 +240,211 @@ void at_set_perm(unsigned int page_index, unsigned int perm)
  */
 unsigned int at_is_allocated(unsigned int page_index)
 {
-    unsigned int allocated;
+    return (AT_ALLOC[page_index / 32] >> (page_index % 32)) & 1;
+}
 
-    allocated = AT[page_index].allocated;
+/**
+ * The setter function for the physical page allocation flag.
+ * Set the flag of the page with given index to the given value.
+ * A newly allocated page has one reference, and a free page has none.
+ */
+void at_set_allocated(unsigned int page_index, unsigned int allocated)
+{
     if (allocated > 0) {
-        allocated = 1;
+        AT_REF[page_index] = 1;
+        bitmap_set(AT_ALLOC, page_index);
+    } else {
+        bitmap_clear(AT_ALLOC, page_index);
+        AT_REF[page_index] = 0;
     }
+}
 
-    return allocated;
+// Returns the number of references to the page with the given index.
+unsigned int at_get_ref(unsigned int page_index)
+{
+    return AT_REF[page_index];
 }
 
 /**
- * The setter function for the physical page allocation flag.
- * Set the flag of the page with given index to the given value.
+ * Atomically adds one reference to the page with the given index,
+ * and returns the new number of references.
  */
-void at_set_allocated(unsigned int page_index, unsigned int allocated)
+unsigned int at_inc_ref(unsigned int page_index)
+{
+    unsigned short old = 1;
+
+    asm volatile ("lock; xaddw %0, %1"
+                  : "+r" (old), "+m" (AT_REF[page_index])
+                  :
+                  : "cc", "memory");
+
+    return old + 1;
+}
+
+/**
+ * Atomically drops one reference to the page with the given index,
+ * and returns the number of references left.
+ * The page can be freed once it returns 0.
+ */
+unsigned int at_dec_ref(unsigned int page_index)
+{
+    unsigned short old = (unsigned short) -1;
+
+    asm volatile ("lock; xaddw %0, %1"
+                  : "+r" (old), "+m" (AT_REF[page_index])
+                  :
+                  : "cc", "memory");
+
+    return old - 1;
+}
+
+/**
+ * Returns the index of the first page in [from, to) that has the normal
+ * permission and is not allocated, or [to] if there is no such page.
+ * The table is scanned 32 pages at a time.
+ */
+unsigned int at_find_free(unsigned int from, unsigned int to)
+{
+    unsigned int word, bits;
+
+    if (from >= to) {
+        return to;
+    }
+
+    word = from / 32;
+    bits = free_bits(word) & (0xFFFFFFFF << (from % 32));
+    while (bits == 0) {
+        word++;
+        if (word * 32 >= to) {
+            return to;
+        }
+        bits = free_bits(word);
+    }
+
+    from = word * 32 + bsf(bits);
+    return from < to ? from : to;
+}
+
+/**
+ * Returns the index of the first page in [from, to) that is either allocated
+ * or does not have the normal permission, or [to] if there is no such page.
+ * The table is scanned 32 pages at a time.
+ */
+unsigned int at_find_nonfree(unsigned int from, unsigned int to)
+{
+    unsigned int word, bits;
+
+    if (from >= to) {
+        return to;
+    }
+
+    word = from / 32;
+    bits = ~free_bits(word) & (0xFFFFFFFF << (from % 32));
+    while (bits == 0) {
+        word++;
+        if (word * 32 >= to) {
+            return to;
+        }
+        bits = ~free_bits(word);
+    }
+
+    from = word * 32 + bsf(bits);
+    return from < to ? from : to;
+}
+
+// Returns the number of pages in [from, to) that have the normal permission and are not allocated.
+unsigned int at_count_free(unsigned int from, unsigned int to)
+{
+    unsigned int word, last, bits, count;
+
+    if (from >= to) {
+        return 0;
+    }
+
+    word = from / 32;
+    last = (to - 1) / 32;
+    count = 0;
+    while (word <= last) {
+        bits = free_bits(word);
+        if (word == from / 32) {
+            bits &= 0xFFFFFFFF << (from % 32);
+        }
+        if (word == last && to % 32 != 0) {
+            bits &= 0xFFFFFFFF >> (32 - to % 32);
+        }
+        count += popcount(bits);
+        word++;
+    }
+
+    return count;
+}
+
+/**
+ * The getter function for the free block flag.
+ * Returns 1 if the page with the given index is the first page of a block
+ * on one of the free lists, otherwise returns 0.
+ */
+unsigned int at_is_free_block(unsigned int page_index)
+{
+    return (AT_FREE[page_index / 32] >> (page_index % 32)) & 1;
+}
+
+/**
+ * The getter function for the order of the free block at the given page.
+ * Returns 0 if the page is not the first page of a free block.
+ */
+unsigned int at_get_order(unsigned int page_index)
+{
+    return at_is_free_block(page_index) ? at_block(page_index)->order : 0;
+}
+
+/**
+ * The setter function for the free block flag.
+ * Marks the page with the given index as the first page of a free block
+ * of the given order. An order of MAX_ORDER + 1 clears the flag.
+ */
+void at_set_free_block(unsigned int page_index, unsigned int order)
+{
+    if (order <= MAX_ORDER) {
+        AT_FREE[page_index / 32] |= 1 << (page_index % 32);
+        at_block(page_index)->order = order;
+    } else {
+        AT_FREE[page_index / 32] &= ~(1 << (page_index % 32));
+    }
+}
+
+/**
+ * The getter and setter functions for the links of the free block at the
+ * given page, which must be the first page of a free block.
+ */
+unsigned int at_get_prev(unsigned int page_index)
+{
+    return at_block(page_index)->prev;
+}
+
+void at_set_prev(unsigned int page_index, unsigned int prev)
+{
+    at_block(page_index)->prev = prev;
+}
+
+unsigned int at_get_next(unsigned int page_index)
+{
+    return at_block(page_index)->next;
+}
+
+void at_set_next(unsigned int page_index, unsigned int next)
+{
+    at_block(page_index)->next = next;
+}
+
+// The getter function for the head of the free list of the given order.
+unsigned int at_get_free_head(unsigned int order)
+{
+    return FREE_HEAD[order];
+}
+
+// The setter function for the head of the free list of the given order.
+void at_set_free_head(unsigned int order, unsigned int page_index)
 {
-    AT[page_index].allocated = allocated;
+    FREE_HEAD[order] = page_index;
 }
@@ -9,12 +9,32 @@ void mem_unlock(void);
 
 unsigned int get_nps(void);
 void set_nps(unsigned int page_index);
+unsigned int get_nnorm(void);
+void set_nnorm(unsigned int nnorm);
 
 unsigned int at_is_norm(unsigned int page_index);
 void at_set_perm(unsigned int page_index, unsigned int perm);
+unsigned int at_set_perm_range(unsigned int from, unsigned int to, unsigned int perm);
 
 unsigned int at_is_allocated(unsigned int page_index);
 void at_set_allocated(unsigned int page_index, unsigned int allocated);
+unsigned int at_get_ref(unsigned int page_index);
+unsigned int at_inc_ref(unsigned int page_index);
+unsigned int at_dec_ref(unsigned int page_index);
+
+unsigned int at_find_free(unsigned int from, unsigned int to);
+unsigned int at_find_nonfree(unsigned int from, unsigned int to);
+unsigned int at_count_free(unsigned int from, unsigned int to);
+
+unsigned int at_is_free_block(unsigned int page_index);
+unsigned int at_get_order(unsigned int page_index);
+void at_set_free_block(unsigned int page_index, unsigned int order);
+unsigned int at_get_prev(unsigned int page_index);
+void at_set_prev(unsigned int page_index, unsigned int prev);
+unsigned int at_get_next(unsigned int page_index);
+void at_set_next(unsigned int page_index, unsigned int next);
+unsigned int at_get_free_head(unsigned int order);
+void at_set_free_head(unsigned int order, unsigned int page_index);
 
 #endif  /* _KERN_ */
 
@@ -1,4 +1,5 @@
 #include <lib/debug.h>
+#include <lib/x86.h>
 #include "export.h"
 
 int MATIntro_test1()
@@ -75,6 +76,133 @@ int MATIntro_test3()
     return 0;
 }
 
+int MATIntro_test4()
+{
+    // Pages 96 to 159 are kernel pages that are never allocated.
+    at_set_perm(100, 2);
+    at_set_perm(131, 2);
+    at_set_perm(159, 2);
+    at_set_allocated(131, 1);
+    if (at_find_free(96, 160) != 100 || at_find_free(101, 160) != 159
+        || at_find_free(101, 159) != 159 || at_find_free(160, 160) != 160) {
+        dprintf("test 4.1 failed: (%d != 100 || %d != 159 || %d != 159 || %d != 160)\n",
+                at_find_free(96, 160), at_find_free(101, 160),
+                at_find_free(101, 159), at_find_free(160, 160));
+        goto fail;
+    }
+    if (at_find_nonfree(100, 160) != 101 || at_find_nonfree(159, 160) != 160) {
+        dprintf("test 4.2 failed: (%d != 101 || %d != 160)\n",
+                at_find_nonfree(100, 160), at_find_nonfree(159, 160));
+        goto fail;
+    }
+    if (at_count_free(96, 160) != 2 || at_count_free(101, 159) != 0
+        || at_count_free(100, 101) != 1) {
+        dprintf("test 4.3 failed: (%d != 2 || %d != 0 || %d != 1)\n",
+                at_count_free(96, 160), at_count_free(101, 159), at_count_free(100, 101));
+        goto fail;
+    }
+    at_set_perm(100, 1);
+    at_set_perm(131, 1);
+    at_set_perm(159, 1);
+    dprintf("test 4 passed.\n");
+    return 0;
+
+fail:
+    at_set_perm(100, 1);
+    at_set_perm(131, 1);
+    at_set_perm(159, 1);
+    return 1;
+}
+
+#define BENCH_FROM  (0x40000000 / 4096)
+#define BENCH_PAGES (1 << 16)
+
+// The table layout used before the bitmaps, with 8 bytes per page.
+static struct {
+    unsigned int perm;
+    unsigned int allocated;
+} old_at[BENCH_PAGES];
+
+/**
+ * Counts the free pages among the first 256MB of the user range three ways:
+ * over the old 8 byte per page layout, through the per-page getters, and
+ * with the word-at-a-time scan. All three must agree.
+ */
+int MATIntro_test5()
+{
+    unsigned int i, to, n_old, n_get, n_word;
+    unsigned long long t0, t1, t2, t3;
+
+    to = BENCH_FROM + BENCH_PAGES;
+    if (get_nps() < to) {
+        to = get_nps();
+    }
+    if (to <= BENCH_FROM) {
+        dprintf("test 5 skipped: no user pages.\n");
+        return 0;
+    }
+
+    for (i = BENCH_FROM; i < to; i++) {
+        old_at[i - BENCH_FROM].perm = at_is_norm(i) ? 2 : 0;
+        old_at[i - BENCH_FROM].allocated = at_is_allocated(i);
+    }
+
+    t0 = rdtsc();
+    n_old = 0;
+    for (i = BENCH_FROM; i < to; i++) {
+        if (old_at[i - BENCH_FROM].perm > 1 && old_at[i - BENCH_FROM].allocated == 0) {
+            n_old++;
+        }
+    }
+    t1 = rdtsc();
+    n_get = 0;
+    for (i = BENCH_FROM; i < to; i++) {
+        if (at_is_norm(i) && !at_is_allocated(i)) {
+            n_get++;
+        }
+    }
+    t2 = rdtsc();
+    n_word = at_count_free(BENCH_FROM, to);
+    t3 = rdtsc();
+
+    if (n_old != n_get || n_get != n_word) {
+        dprintf("test 5.1 failed: (%d != %d || %d != %d)\n", n_old, n_get, n_get, n_word);
+        return 1;
+    }
+    dprintf("scan of %d pages: struct %d cycles, getters %d cycles, bitmap words %d cycles.\n",
+            to - BENCH_FROM, (unsigned int) (t1 - t0), (unsigned int) (t2 - t1),
+            (unsigned int) (t3 - t2));
+    dprintf("test 5 passed.\n");
+    return 0;
+}
+
+int MATIntro_test6()
+{
+    at_set_allocated(1, 1);
+    if (at_get_ref(1) != 1) {
+        dprintf("test 6.1 failed: (%d != 1)\n", at_get_ref(1));
+        at_set_allocated(1, 0);
+        return 1;
+    }
+    if (at_inc_ref(1) != 2 || at_inc_ref(1) != 3 || at_get_ref(1) != 3) {
+        dprintf("test 6.2 failed: (%d != 3)\n", at_get_ref(1));
+        at_set_allocated(1, 0);
+        return 1;
+    }
+    if (at_dec_ref(1) != 2 || at_dec_ref(1) != 1 || at_dec_ref(1) != 0) {
+        dprintf("test 6.3 failed: (%d != 0)\n", at_get_ref(1));
+        at_set_allocated(1, 0);
+        return 1;
+    }
+    at_set_allocated(1, 0);
+    if (at_get_ref(1) != 0) {
+        dprintf("test 6.4 failed: (%d != 0)\n", at_get_ref(1));
+        return 1;
+    }
+    dprintf("test 6 passed.\n");
+    return 0;
+}
+
 /**
  * Write Your Own Test Script (optional)
  *
@@ -97,5 +225,6 @@ int MATIntro_test_own()
 
 int test_MATIntro()
 {
-    return MATIntro_test1() + MATIntro_test2() + MATIntro_test3() + MATIntro_test_own();
+    return MATIntro_test1() + MATIntro_test2() + MATIntro_test3() + MATIntro_test4()
+        + MATIntro_test5() + MATIntro_test6() + MATIntro_test_own();
 }
@@ -1,5 +1,9 @@
 #include <lib/debug.h>
+#include <lib/gcc.h>
+#include <lib/spinlock.h>
 #include <lib/types.h>
+#include <lib/x86.h>
+#include <pcpu/PCPUIntro/export.h>
 #include "import.h"
 
 #define PAGESIZE     4096
@@ -8,71 +12,871 @@
 #define VM_USERLO_PI (VM_USERLO / PAGESIZE)
 #define VM_USERHI_PI (VM_USERHI / PAGESIZE)
 
-static unsigned int last_palloc_index = VM_USERLO_PI;
+// The maximum number of pages kept in one per-CPU cache.
+#define PCACHE_SIZE  64
+// The number of pages moved between a per-CPU cache and the free lists at once.
+#define PCACHE_BATCH 32
+
+// The total number of pages on the free lists.
+static unsigned int nr_free_pages;
 
 /**
- * Allocate a physical page.
- *
- * 1. First, implement a naive page allocator that scans the allocation table (AT)
- *    using the functions defined in import.h to find the first unallocated page
- *    with normal permissions.
- *    (Q: Do you have to scan the allocation table from index 0? Recall how you have
- *    initialized the table in pmem_init.)
- *    Then mark the page as allocated in the allocation table and return the page
- *    index of the page found. In the case when there is no available page found,
- *    return 0.
- * 2. Optimize the code using memoization so that you do not have to
- *    scan the allocation table from scratch every time.
+ * Per-CPU magazine of free pages in front of the free lists.
+ * A cache is only touched by its own CPU with interrupts disabled, so it needs
+ * no lock. Cached pages are marked as unallocated in the allocation table
+ * but are not on the free lists.
  */
-unsigned int palloc()
+struct PCache {
+    unsigned int nr;                    // the number of cached pages
+    unsigned int pages[PCACHE_SIZE];    // the cached page indices
+    unsigned int allocs;                // single page allocations on this CPU
+    unsigned int hits;                  // allocations served from the cache
+    unsigned int refills;               // batches taken from the free lists
+    unsigned int drains;                // batches returned to the free lists
+};
+
+static struct PCache pcache[NUM_CPUS];
+
+// The maximum number of pages in the pool of pre-zeroed pages.
+#define ZPOOL_SIZE 256
+
+/**
+ * Pool of pages that were zeroed ahead of time by an idle CPU.
+ * Pooled pages are marked as allocated in the allocation table.
+ */
+static spinlock_t zpool_lk;
+static unsigned int zpool[ZPOOL_SIZE];
+static unsigned int zpool_nr;
+static unsigned int zpool_hits;     // zeroed pages served from the pool
+static unsigned int zpool_misses;   // zeroed pages cleared inline
+
+// Whether the CPU supports the non-temporal movnti store (SSE2).
+static bool zero_nt;
+
+/**
+ * Inserts the free block of the given order starting at page_index
+ * at the head of the free list of that order.
+ * The free lists are linked through the free pages themselves (see MATIntro),
+ * so the allocator is only called with the kernel's page structure loaded.
+ */
+static void buddy_list_add(unsigned int page_index, unsigned int order)
+{
+    unsigned int head = at_get_free_head(order);
+
+    at_set_free_block(page_index, order);
+    at_set_prev(page_index, 0);
+    at_set_next(page_index, head);
+    if (head != 0) {
+        at_set_prev(head, page_index);
+    }
+    at_set_free_head(order, page_index);
+
+    nr_free_pages += 1 << order;
+}
+
+/**
+ * Removes the free block of the given order starting at page_index
+ * from the free list of that order.
+ */
+static void buddy_list_del(unsigned int page_index, unsigned int order)
+{
+    unsigned int prev = at_get_prev(page_index);
+    unsigned int next = at_get_next(page_index);
+
+    if (prev != 0) {
+        at_set_next(prev, next);
+    } else {
+        at_set_free_head(order, next);
+    }
+    if (next != 0) {
+        at_set_prev(next, prev);
+    }
+    at_set_free_block(page_index, MAX_ORDER + 1);
+
+    nr_free_pages -= 1 << order;
+}
+
+/**
+ * Takes a block of 2^order pages off the free lists, splitting a larger
+ * block if no block of the exact order is free. The upper halves produced by
+ * the split go back to the free lists of the lower orders.
+ * Returns the first page index of the block, or 0 if no block is available.
+ * The caller must hold the memory lock.
+ */
+static unsigned int buddy_take(unsigned int order)
+{
+    unsigned int cur_order, page_index;
+
+    cur_order = order;
+    while (cur_order <= MAX_ORDER && at_get_free_head(cur_order) == 0) {
+        cur_order++;
+    }
+    if (cur_order > MAX_ORDER) {
+        return 0;
+    }
+
+    page_index = at_get_free_head(cur_order);
+    buddy_list_del(page_index, cur_order);
+
+    while (cur_order > order) {
+        cur_order--;
+        buddy_list_add(page_index + (1 << cur_order), cur_order);
+    }
+
+    return page_index;
+}
+
+/**
+ * Returns the unallocated block of 2^order pages starting at page_index to
+ * the free lists, merging it with its buddy as long as the buddy is a free
+ * block of the same order. The caller must hold the memory lock.
+ */
+static void buddy_put(unsigned int page_index, unsigned int order)
 {
-    unsigned int nps;
-    unsigned int palloc_index;
-    unsigned int palloc_free_index;
-    bool first;
+    unsigned int buddy;
+
+    while (order < MAX_ORDER) {
+        buddy = page_index ^ (1 << order);
+        if (!at_is_free_block(buddy) || at_get_order(buddy) != order) {
+            break;
+        }
+        buddy_list_del(buddy, order);
+        if (buddy < page_index) {
+            page_index = buddy;
+        }
+        order++;
+    }
+
+    buddy_list_add(page_index, order);
+}
+
+// Same as buddy_take, but also marks the pages of the block as allocated.
+static unsigned int buddy_alloc(unsigned int order)
+{
+    unsigned int page_index, i;
+
+    page_index = buddy_take(order);
+    if (page_index != 0) {
+        for (i = 0; i < (1 << order); i++) {
+            at_set_allocated(page_index + i, 1);
+        }
+    }
+
+    return page_index;
+}
+
+// Same as buddy_put, but first marks the pages of the block as unallocated.
+static void buddy_free(unsigned int page_index, unsigned int order)
+{
+    unsigned int i;
+
+    for (i = 0; i < (1 << order); i++) {
+        at_set_allocated(page_index + i, 0);
+    }
+    buddy_put(page_index, order);
+}
+
+/**
+ * Fills the cache of the current CPU with up to PCACHE_BATCH pages from the
+ * free lists under a single acquisition of the memory lock.
+ */
+static void pcache_refill(struct PCache *cache)
+{
+    unsigned int page_index;
+
+    mem_lock();
+    while (cache->nr < PCACHE_BATCH && (page_index = buddy_take(0)) != 0) {
+        cache->pages[cache->nr++] = page_index;
+    }
+    mem_unlock();
+
+    cache->refills++;
+}
+
+/**
+ * Returns the n least recently freed pages of the cache of the current CPU
+ * to the free lists under a single acquisition of the memory lock.
+ */
+static void pcache_drain(struct PCache *cache, unsigned int n)
+{
+    unsigned int i;
+
+    if (n > cache->nr) {
+        n = cache->nr;
+    }
+    if (n == 0) {
+        return;
+    }
 
     mem_lock();
+    for (i = 0; i < n; i++) {
+        buddy_put(cache->pages[i], 0);
+    }
+    mem_unlock();
+
+    for (i = n; i < cache->nr; i++) {
+        cache->pages[i - n] = cache->pages[i];
+    }
+    cache->nr -= n;
+    cache->drains++;
+}
+
+// Clears the page with the given index through the identity map.
+static gcc_inline void page_zero(unsigned int page_index)
+{
+    unsigned int *dst = (unsigned int *) (page_index * PAGESIZE);
+    unsigned int cnt = PAGESIZE / 4;
+
+    asm volatile ("cld; rep stosl"
+                  : "+D" (dst), "+c" (cnt)
+                  : "a" (0)
+                  : "cc", "memory");
+}
+
+/**
+ * Clears the page with the given index with non-temporal stores, so that
+ * zeroing pages in the background does not evict the working set from the
+ * cache. Falls back to page_zero without SSE2.
+ */
+static void page_zero_nt(unsigned int page_index)
+{
+    unsigned int *dst = (unsigned int *) (page_index * PAGESIZE);
+    unsigned int i;
+
+    if (!zero_nt) {
+        page_zero(page_index);
+        return;
+    }
+
+    for (i = 0; i < PAGESIZE / 4; i += 4) {
+        asm volatile ("movnti %1, 0(%0)\n\t"
+                      "movnti %1, 4(%0)\n\t"
+                      "movnti %1, 8(%0)\n\t"
+                      "movnti %1, 12(%0)"
+                      :
+                      : "r" (dst + i), "r" (0)
+                      : "memory");
+    }
+    asm volatile ("sfence" ::: "memory");
+}
+
+// Takes a page off the pool of pre-zeroed pages. Returns 0 if the pool is empty.
+static unsigned int zpool_pop(void)
+{
+    unsigned int page_index = 0;
+
+    spinlock_acquire(&zpool_lk);
+    if (zpool_nr > 0) {
+        page_index = zpool[--zpool_nr];
+    }
+    spinlock_release(&zpool_lk);
+
+    return page_index;
+}
+
+/**
+ * Puts the pages in [start, end) onto the free lists, carving the range into
+ * the largest naturally aligned blocks that fit. Blocks produced this way
+ * never have a free buddy inside the range, so no merging is needed.
+ */
+static void buddy_add_range(unsigned int start, unsigned int end)
+{
+    unsigned int order;
+
+    while (start < end) {
+        order = MAX_ORDER;
+        while ((start & ((1 << order) - 1)) != 0 || end - start < (1 << order)) {
+            order--;
+        }
+        buddy_list_add(start, order);
+        start += 1 << order;
+    }
+}
+
+/**
+ * Checks the buddy free lists against the allocation table.
+ * Every free block must be naturally aligned, lie in the user range, and
+ * consist of unallocated pages with the normal permission; the free lists
+ * must cover exactly the unallocated normal pages of the table.
+ * Returns 0 if they agree, otherwise a non-zero value.
+ */
+unsigned int palloc_check(void)
+{
+    unsigned int order, page_index, i, nblocks, cpu;
+    unsigned int nps, listed, cached, counted;
 
     nps = get_nps();
-    palloc_index = last_palloc_index;
-    palloc_free_index = nps;
-    first = TRUE;
+    if (nps > VM_USERHI_PI) {
+        nps = VM_USERHI_PI;
+    }
+
+    mem_lock();
+
+    listed = 0;
+    for (order = 0; order <= MAX_ORDER; order++) {
+        nblocks = 0;
+        page_index = at_get_free_head(order);
+        while (page_index != 0) {
+            if (page_index < VM_USERLO_PI || nps < page_index + (1 << order)
+                || (page_index & ((1 << order) - 1)) != 0
+                || !at_is_free_block(page_index)
+                || at_get_order(page_index) != order
+                || nblocks++ > nps / (1 << order)) {
+                mem_unlock();
+                return 1;
+            }
+            for (i = 0; i < (1 << order); i++) {
+                if (!at_is_norm(page_index + i) || at_is_allocated(page_index + i)) {
+                    mem_unlock();
+                    return 1;
+                }
+            }
+            listed += 1 << order;
+            page_index = at_get_next(page_index);
+        }
+    }
 
-    while ((palloc_index != last_palloc_index || first) && palloc_free_index == nps) {
-        first = FALSE;
-        if (at_is_norm(palloc_index) && !at_is_allocated(palloc_index)) {
-            palloc_free_index = palloc_index;
+    cached = 0;
+    for (cpu = 0; cpu < NUM_CPUS; cpu++) {
+        for (i = 0; i < pcache[cpu].nr; i++) {
+            page_index = pcache[cpu].pages[i];
+            if (!at_is_norm(page_index) || at_is_allocated(page_index)
+                || at_is_free_block(page_index)) {
+                mem_unlock();
+                return 1;
+            }
         }
-        palloc_index++;
-        if (palloc_index >= VM_USERHI_PI) {
-            palloc_index = VM_USERLO_PI;
+        cached += pcache[cpu].nr;
+    }
+
+    counted = at_count_free(VM_USERLO_PI, nps);
+
+    mem_unlock();
+
+    return listed + cached != counted || listed != nr_free_pages;
+}
+
+/**
+ * Initializes the allocation table through the lower layer, then builds the
+ * buddy free lists from every run of unallocated pages with the normal
+ * permission, and checks that the free lists agree with the table.
+ * The per-CPU caches and the pool of pre-zeroed pages start empty.
+ */
+void palloc_init(unsigned int mbi_addr)
+{
+    unsigned int nps, pg_idx, run_start;
+    unsigned int eax, ebx, ecx, edx;
+    unsigned long long tsc_start;
+
+    pmem_init(mbi_addr);
+
+    tsc_start = rdtsc();
+    nr_free_pages = 0;
+
+    spinlock_init(&zpool_lk);
+    zpool_nr = 0;
+    cpuid(0x1, &eax, &ebx, &ecx, &edx);
+    zero_nt = (edx & CPUID_FEATURE_SSE2) ? TRUE : FALSE;
+
+    nps = get_nps();
+    if (nps > VM_USERHI_PI) {
+        nps = VM_USERHI_PI;
+    }
+
+    pg_idx = VM_USERLO_PI;
+    while (pg_idx < nps) {
+        run_start = at_find_free(pg_idx, nps);
+        pg_idx = at_find_nonfree(run_start, nps);
+        buddy_add_range(run_start, pg_idx);
+    }
+
+    KERN_INFO("[TSC] palloc_init: %d free pages, %llu cycles.\n",
+              nr_free_pages, rdtsc() - tsc_start);
+
+    if (nr_free_pages != get_nnorm() || palloc_check() != 0) {
+        KERN_PANIC("The buddy free lists disagree with the allocation table.\n");
+    }
+}
+
+/**
+ * Allocates 2^order physically contiguous pages. The first page index of
+ * the block is aligned to 2^order.
+ * Returns the first page index, or 0 if the request cannot be satisfied.
+ */
+unsigned int palloc_order(unsigned int order)
+{
+    unsigned int page_index;
+
+    if (order > MAX_ORDER) {
+        return 0;
+    }
+
+    mem_lock();
+    page_index = buddy_alloc(order);
+    mem_unlock();
+
+    // The pages held by the cache of the current CPU may complete a block.
+    if (page_index == 0 && order > 0) {
+        pcache_drain(&pcache[get_pcpu_idx()], PCACHE_SIZE);
+        mem_lock();
+        page_index = buddy_alloc(order);
+        mem_unlock();
+    }
+
+    return page_index;
+}
+
+/**
+ * Frees the block of 2^order pages starting at pfree_index, which must have
+ * been returned by palloc_order with the same order. Blocks that are not
+ * allocated are ignored.
+ */
+void pfree_order(unsigned int pfree_index, unsigned int order)
+{
+    if (order > MAX_ORDER || (pfree_index & ((1 << order) - 1)) != 0) {
+        return;
+    }
+
+    mem_lock();
+    if (at_is_norm(pfree_index) && at_is_allocated(pfree_index)) {
+        buddy_free(pfree_index, order);
+    }
+    mem_unlock();
+}
+
+/**
+ * Takes 2^MAX_ORDER * nblocks contiguous pages starting at a page index
+ * aligned to align off the free lists, using only blocks of the maximal
+ * order that lie next to each other.
+ * Returns the first page index of the run, or 0 if there is no such run.
+ * The caller must hold the memory lock.
+ */
+static unsigned int buddy_take_run(unsigned int nblocks, unsigned int align)
+{
+    unsigned int page_index, i;
+
+    page_index = at_get_free_head(MAX_ORDER);
+    while (page_index != 0) {
+        if ((page_index & (align - 1)) == 0) {
+            for (i = 1; i < nblocks; i++) {
+                if (!at_is_free_block(page_index + (i << MAX_ORDER))
+                    || at_get_order(page_index + (i << MAX_ORDER)) != MAX_ORDER) {
+                    break;
+                }
+            }
+            if (i == nblocks) {
+                for (i = 0; i < nblocks; i++) {
+                    buddy_list_del(page_index + (i << MAX_ORDER), MAX_ORDER);
+                }
+                return page_index;
+            }
         }
+        page_index = at_get_next(page_index);
     }
 
-    if (palloc_free_index == nps) {
-        palloc_free_index = 0;
-        last_palloc_index = VM_USERLO_PI;
+    return 0;
+}
+
+/**
+ * Takes npages contiguous pages starting at a page index aligned to align
+ * off the free lists and marks them as allocated.
+ * A run that fits in a single block is cut from the smallest block that is
+ * large enough for both the size and the alignment; the pages past the end
+ * of the run go back to the free lists. Longer runs are assembled from
+ * neighbouring blocks of the maximal order.
+ * Returns the first page index of the run, or 0 on failure.
+ * The caller must hold the memory lock.
+ */
+static unsigned int buddy_alloc_contig(unsigned int npages, unsigned int align)
+{
+    unsigned int order, nblocks, page_index, i;
+
+    if (npages <= (1 << MAX_ORDER) && align <= (1 << MAX_ORDER)) {
+        order = 0;
+        while ((1 << order) < npages || (1 << order) < align) {
+            order++;
+        }
+        page_index = buddy_take(order);
+        if (page_index == 0) {
+            return 0;
+        }
+        buddy_add_range(page_index + npages, page_index + (1 << order));
     } else {
-        at_set_allocated(palloc_free_index, 1);
-        last_palloc_index = palloc_free_index;
+        nblocks = (npages + (1 << MAX_ORDER) - 1) >> MAX_ORDER;
+        page_index = buddy_take_run(nblocks, align);
+        if (page_index == 0) {
+            return 0;
+        }
+        buddy_add_range(page_index + npages, page_index + (nblocks << MAX_ORDER));
     }
 
+    for (i = 0; i < npages; i++) {
+        at_set_allocated(page_index + i, 1);
+    }
+
+    return page_index;
+}
+
+/**
+ * Allocates npages physically contiguous pages whose first page index is
+ * a multiple of align, which must be a power of two (e.g., 1024 for a run
+ * aligned to 4MB).
+ * Returns the first page index, or 0 if the request cannot be satisfied.
+ */
+unsigned int palloc_contig(unsigned int npages, unsigned int align)
+{
+    unsigned int page_index;
+
+    if (npages == 0 || align == 0 || (align & (align - 1)) != 0) {
+        return 0;
+    }
+
+    mem_lock();
+    page_index = buddy_alloc_contig(npages, align);
     mem_unlock();
 
-    return palloc_free_index;
+    // The pages held by the cache of the current CPU may complete a run.
+    if (page_index == 0) {
+        pcache_drain(&pcache[get_pcpu_idx()], PCACHE_SIZE);
+        mem_lock();
+        page_index = buddy_alloc_contig(npages, align);
+        mem_unlock();
+    }
+
+    return page_index;
 }
 
 /**
- * Free a physical page.
- *
- * This function marks the page with given index as unallocated
- * in the allocation table.
- *
- * Hint: Simple.
+ * Frees the npages contiguous pages starting at pfree_index, e.g., a run
+ * returned by palloc_contig. The run is split into naturally aligned blocks,
+ * each of which is merged back into the free lists.
  */
-void pfree(unsigned int pfree_index)
+void pfree_contig(unsigned int pfree_index, unsigned int npages)
 {
+    unsigned int end, order;
+
+    end = pfree_index + npages;
+
     mem_lock();
-    at_set_allocated(pfree_index, 0);
+    while (pfree_index < end) {
+        order = MAX_ORDER;
+        while ((pfree_index & ((1 << order) - 1)) != 0 || end - pfree_index < (1 << order)) {
+            order--;
+        }
+        if (at_is_norm(pfree_index) && at_is_allocated(pfree_index)) {
+            buddy_free(pfree_index, order);
+        }
+        pfree_index += 1 << order;
+    }
     mem_unlock();
 }
+
+/**
+ * Allocates a physical page.
+ * The page is taken from the cache of the current CPU, which is refilled in
+ * a batch from the free lists when it runs empty. The pool of pre-zeroed
+ * pages is the last resort.
+ * Returns the page index of the allocated page, or 0 if there is no free page.
+ */
+unsigned int palloc()
+{
+    struct PCache *cache = &pcache[get_pcpu_idx()];
+    unsigned int page_index;
+
+    cache->allocs++;
+    if (cache->nr > 0) {
+        cache->hits++;
+    } else {
+        pcache_refill(cache);
+        if (cache->nr == 0) {
+            // Out of free pages; a pre-zeroed page is still a page.
+            return zpool_pop();
+        }
+    }
+
+    page_index = cache->pages[--cache->nr];
+    at_set_allocated(page_index, 1);
+
+    return page_index;
+}
+
+/**
+ * Drops a reference to a physical page, and frees the page once the last
+ * reference is gone.
+ * It marks the page with the given index as unallocated in the allocation
+ * table and puts it into the cache of the current CPU. When the cache is
+ * full, a batch of pages is returned to the free lists first.
+ */
+void pfree(unsigned int pfree_index)
+{
+    struct PCache *cache = &pcache[get_pcpu_idx()];
+
+    if (!at_is_norm(pfree_index) || !at_is_allocated(pfree_index)) {
+        return;
+    }
+
+    if (at_dec_ref(pfree_index) > 0) {
+        return;
+    }
+
+    if (cache->nr == PCACHE_SIZE) {
+        pcache_drain(cache, PCACHE_BATCH);
+    }
+
+    at_set_allocated(pfree_index, 0);
+    cache->pages[cache->nr++] = pfree_index;
+}
+
+/**
+ * Allocates up to n physical pages and stores their indices in pages.
+ * Pages in the cache of the current CPU are used first. The rest is taken
+ * off the free lists in blocks as large as possible under a single
+ * acquisition of the memory lock, and the pool of pre-zeroed pages is the
+ * last resort.
+ * Returns the number of pages allocated.
+ */
+unsigned int palloc_batch(unsigned int *pages, unsigned int n)
+{
+    struct PCache *cache = &pcache[get_pcpu_idx()];
+    unsigned int got, order, page_index, i;
+
+    got = 0;
+    while (got < n && cache->nr > 0) {
+        pages[got++] = cache->pages[--cache->nr];
+    }
+
+    if (got < n) {
+        order = MAX_ORDER;
+        mem_lock();
+        while (got < n) {
+            while ((1 << order) > n - got) {
+                order--;
+            }
+            page_index = buddy_take(order);
+            if (page_index == 0) {
+                if (order == 0) {
+                    break;
+                }
+                order--;
+                continue;
+            }
+            for (i = 0; i < (1 << order); i++) {
+                pages[got++] = page_index + i;
+            }
+        }
+        mem_unlock();
+    }
+
+    for (i = 0; i < got; i++) {
+        at_set_allocated(pages[i], 1);
+    }
+
+    while (got < n && (page_index = zpool_pop()) != 0) {
+        pages[got++] = page_index;
+    }
+
+    return got;
+}
+
+/**
+ * Drops a reference to each of the n physical pages in pages, and frees
+ * the pages whose last reference is gone. Freed pages go to the cache of
+ * the current CPU, and once it is full, to the free lists under a single
+ * acquisition of the memory lock.
+ */
+void pfree_batch(unsigned int *pages, unsigned int n)
+{
+    struct PCache *cache = &pcache[get_pcpu_idx()];
+    unsigned int page_index, i, locked;
+
+    locked = 0;
+    for (i = 0; i < n; i++) {
+        page_index = pages[i];
+        if (!at_is_norm(page_index) || !at_is_allocated(page_index)) {
+            continue;
+        }
+        if (at_dec_ref(page_index) > 0) {
+            continue;
+        }
+
+        at_set_allocated(page_index, 0);
+        if (cache->nr < PCACHE_SIZE) {
+            cache->pages[cache->nr++] = page_index;
+        } else {
+            if (!locked) {
+                mem_lock();
+                locked = 1;
+            }
+            buddy_put(page_index, 0);
+        }
+    }
+    if (locked) {
+        mem_unlock();
+    }
+}
+
+/**
+ * Allocates a physical page from the pool of pre-zeroed pages only.
+ * Returns the page index, or 0 if the pool is empty.
+ */
+unsigned int palloc_prezeroed(void)
+{
+    unsigned int page_index = 0;
+
+    spinlock_acquire(&zpool_lk);
+    if (zpool_nr > 0) {
+        page_index = zpool[--zpool_nr];
+        zpool_hits++;
+    }
+    spinlock_release(&zpool_lk);
+
+    return page_index;
+}
+
+/**
+ * Allocates a physical page that is filled with zeros.
+ * The page is taken from the pool of pre-zeroed pages if possible,
+ * otherwise a page is allocated with palloc and cleared right away.
+ * Returns the page index, or 0 if there is no free page.
+ */
+unsigned int palloc_zeroed(void)
+{
+    unsigned int page_index;
+
+    page_index = palloc_prezeroed();
+    if (page_index == 0) {
+        page_index = palloc();
+        if (page_index != 0) {
+            page_zero(page_index);
+            spinlock_acquire(&zpool_lk);
+            zpool_misses++;
+            spinlock_release(&zpool_lk);
+        }
+    }
+
+    return page_index;
+}
+
+/**
+ * Same as palloc_batch, but the pages are filled with zeros.
+ * The pool of pre-zeroed pages is drained first under a single acquisition of
+ * its lock, and the rest of the pages are allocated with palloc_batch and
+ * cleared right away.
+ * Returns the number of pages allocated.
+ */
+unsigned int palloc_zeroed_batch(unsigned int *pages, unsigned int n)
+{
+    unsigned int got, nr, i;
+
+    got = 0;
+    spinlock_acquire(&zpool_lk);
+    while (got < n && zpool_nr > 0) {
+        pages[got++] = zpool[--zpool_nr];
+    }
+    zpool_hits += got;
+    spinlock_release(&zpool_lk);
+
+    nr = palloc_batch(pages + got, n - got);
+    for (i = got; i < got + nr; i++) {
+        page_zero(pages[i]);
+    }
+    spinlock_acquire(&zpool_lk);
+    zpool_misses += nr;
+    spinlock_release(&zpool_lk);
+
+    return got + nr;
+}
+
+/**
+ * Zeroes up to max free pages and adds them to the pool of pre-zeroed pages.
+ * It is called from the idle loop of the kernel.
+ * Returns the number of pages added to the pool.
+ */
+unsigned int palloc_zero_refill(unsigned int max)
+{
+    unsigned int page_index, n;
+
+    n = 0;
+    while (n < max && zpool_nr < ZPOOL_SIZE) {
+        page_index = palloc();
+        if (page_index == 0) {
+            break;
+        }
+
+        page_zero_nt(page_index);
+
+        spinlock_acquire(&zpool_lk);
+        if (zpool_nr < ZPOOL_SIZE) {
+            zpool[zpool_nr++] = page_index;
+            page_index = 0;
+        }
+        spinlock_release(&zpool_lk);
+
+        if (page_index != 0) {
+            pfree(page_index);
+            break;
+        }
+        n++;
+    }
+
+    return n;
+}
+
+// Returns the total number of free pages, including the cached and the pre-zeroed ones.
+unsigned int palloc_nr_free(void)
+{
+    unsigned int cpu, nr_free;
+
+    nr_free = nr_free_pages + zpool_nr;
+    for (cpu = 0; cpu < NUM_CPUS; cpu++) {
+        nr_free += pcache[cpu].nr;
+    }
+
+    return nr_free;
+}
+
+/**
+ * The getter functions for the counters of the page cache of the given CPU:
+ * the number of single page allocations, how many of them were served from
+ * the cache, and the number of batches taken from and returned to the free lists.
+ */
+unsigned int pcache_get_allocs(unsigned int cpu_idx)
+{
+    return pcache[cpu_idx].allocs;
+}
+
+unsigned int pcache_get_hits(unsigned int cpu_idx)
+{
+    return pcache[cpu_idx].hits;
+}
+
+unsigned int pcache_get_refills(unsigned int cpu_idx)
+{
+    return pcache[cpu_idx].refills;
+}
+
+unsigned int pcache_get_drains(unsigned int cpu_idx)
+{
+    return pcache[cpu_idx].drains;
+}
+
+/**
+ * The getter functions for the pool of pre-zeroed pages: the number of pooled
+ * pages, and how many zeroed pages, for any purpose (e.g., page tables), were
+ * served from the pool or had to be cleared inline. The page faults served
+ * pre-zeroed are counted per process by the fault path (see vmr_fill).
+ */
+unsigned int zpool_get_nr(void)
+{
+    return zpool_nr;
+}
+
+unsigned int zpool_get_hits(void)
+{
+    return zpool_hits;
+}
+
+unsigned int zpool_get_misses(void)
+{
+    return zpool_misses;
+}
@@ -3,8 +3,28 @@
 
 #ifdef _KERN_
 
+void palloc_init(unsigned int mbi_addr);
 unsigned int palloc(void);
 void pfree(unsigned int pfree_index);
+unsigned int palloc_order(unsigned int order);
+void pfree_order(unsigned int pfree_index, unsigned int order);
+unsigned int palloc_contig(unsigned int npages, unsigned int align);
+void pfree_contig(unsigned int pfree_index, unsigned int npages);
+unsigned int palloc_batch(unsigned int *pages, unsigned int n);
+void pfree_batch(unsigned int *pages, unsigned int n);
+unsigned int palloc_prezeroed(void);
+unsigned int palloc_zeroed(void);
+unsigned int palloc_zeroed_batch(unsigned int *pages, unsigned int n);
+unsigned int palloc_zero_refill(unsigned int max);
+unsigned int palloc_nr_free(void);
+unsigned int palloc_check(void);
+unsigned int pcache_get_allocs(unsigned int cpu_idx);
+unsigned int pcache_get_hits(unsigned int cpu_idx);
+unsigned int pcache_get_refills(unsigned int cpu_idx);
+unsigned int pcache_get_drains(unsigned int cpu_idx);
+unsigned int zpool_get_nr(void);
+unsigned int zpool_get_hits(void);
+unsigned int zpool_get_misses(void);
 
 #endif  /* _KERN_ */
 
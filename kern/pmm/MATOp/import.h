@@ -12,6 +12,9 @@ void mem_unlock(void);
 // The total number of physical pages.
 unsigned int get_nps(void);
 
+// The number of physical pages with the normal permission.
+unsigned int get_nnorm(void);
+
 // Whether the page with the given index has normal permissions.
 unsigned int at_is_norm(unsigned int page_index);
 
@@ -21,6 +24,35 @@ unsigned int at_is_allocated(unsigned int page_index);
 // Mark the allocation flag of the page with the given index using the given value.
 void at_set_allocated(unsigned int page_index, unsigned int allocated);
 
+// Drops a reference to the page with the given index, returning the references left.
+unsigned int at_dec_ref(unsigned int page_index);
+
+// The first page in [from, to) that is (not) available for allocation, or [to] if none.
+unsigned int at_find_free(unsigned int from, unsigned int to);
+unsigned int at_find_nonfree(unsigned int from, unsigned int to);
+// The number of pages in [from, to) that have the normal permission and are unallocated.
+unsigned int at_count_free(unsigned int from, unsigned int to);
+
+/**
+ * Bookkeeping of the buddy allocator.
+ * A free block of order k consists of 2^k pages and starts at a page index
+ * aligned to 2^k. The first page of each free block records the order of the
+ * block and links to the neighbouring free blocks of the same order.
+ */
+unsigned int at_is_free_block(unsigned int page_index);
+unsigned int at_get_order(unsigned int page_index);
+// Marks the first page of a free block. An order of MAX_ORDER + 1 clears the mark.
+void at_set_free_block(unsigned int page_index, unsigned int order);
+unsigned int at_get_prev(unsigned int page_index);
+void at_set_prev(unsigned int page_index, unsigned int prev);
+unsigned int at_get_next(unsigned int page_index);
+void at_set_next(unsigned int page_index, unsigned int next);
+unsigned int at_get_free_head(unsigned int order);
+void at_set_free_head(unsigned int order, unsigned int page_index);
+
+// Lower layer initialization function.
+void pmem_init(unsigned int mbi_addr);
+
 #endif  /* _KERN_ */
 
 #endif  /* !_KERN_PMM_MATOP_H_ */
@@ -1,4 +1,6 @@
 #include <lib/debug.h>
+#include <lib/x86.h>
+#include <pcpu/PCPUIntro/export.h>
 #include <pmm/MATIntro/export.h>
 #include "export.h"
 
@@ -35,6 +37,329 @@ int MATOp_test1()
     return 0;
 }
 
+int MATOp_test2()
+{
+    unsigned int nr_free = palloc_nr_free();
+    unsigned int page_index = palloc_order(3);
+    unsigned int i;
+    if (page_index == 0 || page_index % 8 != 0) {
+        dprintf("test 2.1 failed: (%d == 0 || %d %% 8 != 0)\n", page_index, page_index);
+        pfree_order(page_index, 3);
+        return 1;
+    }
+    for (i = 0; i < 8; i++) {
+        if (at_is_norm(page_index + i) != 1 || at_is_allocated(page_index + i) != 1) {
+            dprintf("test 2.2 failed (i = %d): (%d != 1 || %d != 1)\n", i,
+                    at_is_norm(page_index + i), at_is_allocated(page_index + i));
+            pfree_order(page_index, 3);
+            return 1;
+        }
+    }
+    if (palloc_nr_free() != nr_free - 8) {
+        dprintf("test 2.3 failed: (%d != %d)\n", palloc_nr_free(), nr_free - 8);
+        pfree_order(page_index, 3);
+        return 1;
+    }
+    pfree_order(page_index, 3);
+    for (i = 0; i < 8; i++) {
+        if (at_is_allocated(page_index + i) != 0) {
+            dprintf("test 2.4 failed (i = %d): (%d != 0)\n", i, at_is_allocated(page_index + i));
+            return 1;
+        }
+    }
+    if (palloc_nr_free() != nr_free) {
+        dprintf("test 2.5 failed: (%d != %d)\n", palloc_nr_free(), nr_free);
+        return 1;
+    }
+    if (palloc_order(MAX_ORDER + 1) != 0) {
+        dprintf("test 2.6 failed: order %d should not be allocatable\n", MAX_ORDER + 1);
+        return 1;
+    }
+    dprintf("test 2 passed.\n");
+    return 0;
+}
+
+int MATOp_test3()
+{
+    unsigned int page_index = palloc_order(2);
+    unsigned int order;
+    if (page_index == 0) {
+        dprintf("test 3.1 failed: (%d == 0)\n", page_index);
+        return 1;
+    }
+    // Free the block one page at a time; the pages must merge back.
+    pfree_order(page_index + 2, 0);
+    pfree_order(page_index, 0);
+    pfree_order(page_index + 3, 0);
+    pfree_order(page_index + 1, 0);
+    if (at_is_free_block(page_index + 1) || at_is_free_block(page_index + 2)
+        || at_is_free_block(page_index + 3)) {
+        dprintf("test 3.2 failed: the pages of block %d were not merged\n", page_index);
+        return 1;
+    }
+    order = 2;
+    while (order <= MAX_ORDER
+           && !(at_is_free_block(page_index & ~((1 << order) - 1))
+                && at_get_order(page_index & ~((1 << order) - 1)) == order)) {
+        order++;
+    }
+    if (order > MAX_ORDER) {
+        dprintf("test 3.3 failed: no free block contains page %d\n", page_index);
+        return 1;
+    }
+    if (palloc_check() != 0) {
+        dprintf("test 3.4 failed: the free lists disagree with the allocation table\n");
+        return 1;
+    }
+    dprintf("test 3 passed.\n");
+    return 0;
+}
+
+int MATOp_test4()
+{
+    unsigned int cpu_idx = get_pcpu_idx();
+    unsigned int hits, page_index, page_index2;
+    page_index = palloc();
+    pfree(page_index);
+    hits = pcache_get_hits(cpu_idx);
+    page_index2 = palloc();
+    if (page_index2 != page_index) {
+        dprintf("test 4.1 failed: (%d != %d)\n", page_index2, page_index);
+        pfree(page_index2);
+        return 1;
+    }
+    if (pcache_get_hits(cpu_idx) != hits + 1) {
+        dprintf("test 4.2 failed: (%d != %d)\n", pcache_get_hits(cpu_idx), hits + 1);
+        pfree(page_index2);
+        return 1;
+    }
+    pfree(page_index2);
+    if (at_is_allocated(page_index2) != 0 || palloc_check() != 0) {
+        dprintf("test 4.3 failed: the cached page %d is inconsistent\n", page_index2);
+        return 1;
+    }
+    dprintf("test 4 passed.\n");
+    return 0;
+}
+
+int MATOp_test5()
+{
+    unsigned int nr_free = palloc_nr_free();
+    unsigned int page_index, i;
+    page_index = palloc_contig(5, 4);
+    if (page_index == 0 || page_index % 4 != 0) {
+        dprintf("test 5.1 failed: (%d == 0 || %d %% 4 != 0)\n", page_index, page_index);
+        pfree_contig(page_index, 5);
+        return 1;
+    }
+    for (i = 0; i < 5; i++) {
+        if (at_is_allocated(page_index + i) != 1) {
+            dprintf("test 5.2 failed (i = %d): (%d != 1)\n", i, at_is_allocated(page_index + i));
+            pfree_contig(page_index, 5);
+            return 1;
+        }
+    }
+    if (palloc_nr_free() != nr_free - 5) {
+        dprintf("test 5.3 failed: (%d != %d)\n", palloc_nr_free(), nr_free - 5);
+        pfree_contig(page_index, 5);
+        return 1;
+    }
+    pfree_contig(page_index, 5);
+    // A 4MB aligned run spanning more than one maximal block.
+    page_index = palloc_contig((1 << MAX_ORDER) + 1, 1 << MAX_ORDER);
+    if (page_index == 0 || page_index % (1 << MAX_ORDER) != 0
+        || at_is_allocated(page_index + (1 << MAX_ORDER)) != 1
+        || at_is_allocated(page_index + (1 << MAX_ORDER) + 1) != 0) {
+        dprintf("test 5.4 failed: bad run at %d\n", page_index);
+        pfree_contig(page_index, (1 << MAX_ORDER) + 1);
+        return 1;
+    }
+    pfree_contig(page_index, (1 << MAX_ORDER) + 1);
+    if (palloc_nr_free() != nr_free || palloc_check() != 0) {
+        dprintf("test 5.5 failed: (%d != %d || %d != 0)\n",
+                palloc_nr_free(), nr_free, palloc_check());
+        return 1;
+    }
+    if (palloc_contig(1, 3) != 0 || palloc_contig(0, 1) != 0) {
+        dprintf("test 5.6 failed: invalid requests should fail\n");
+        return 1;
+    }
+    dprintf("test 5 passed.\n");
+    return 0;
+}
+
+int MATOp_test6()
+{
+    unsigned int nr_free = palloc_nr_free();
+    unsigned int block, page_index, i;
+    // Fragment a 64 page block by freeing every other page.
+    block = palloc_order(6);
+    if (block == 0) {
+        dprintf("test 6.1 failed: (%d == 0)\n", block);
+        return 1;
+    }
+    for (i = 1; i < 64; i += 2) {
+        pfree_order(block + i, 0);
+    }
+    // No run of two pages is left inside the block.
+    page_index = palloc_contig(2, 1);
+    if (page_index == 0 || (block <= page_index + 1 && page_index < block + 64)) {
+        dprintf("test 6.2 failed: run %d overlaps the fragmented block %d\n", page_index, block);
+        pfree_contig(page_index, 2);
+        return 1;
+    }
+    pfree_contig(page_index, 2);
+    // Single pages still fit into the holes.
+    page_index = palloc_contig(1, 1);
+    if (page_index == 0 || at_is_allocated(page_index) != 1) {
+        dprintf("test 6.3 failed: (%d == 0)\n", page_index);
+        pfree_contig(page_index, 1);
+        return 1;
+    }
+    pfree_contig(page_index, 1);
+    // Once the rest is freed, the block merges back.
+    for (i = 0; i < 64; i += 2) {
+        pfree_order(block + i, 0);
+    }
+    if (palloc_nr_free() != nr_free || palloc_check() != 0) {
+        dprintf("test 6.4 failed: (%d != %d || %d != 0)\n",
+                palloc_nr_free(), nr_free, palloc_check());
+        return 1;
+    }
+    page_index = palloc_contig(64, 64);
+    if (page_index == 0) {
+        dprintf("test 6.5 failed: (%d == 0)\n", page_index);
+        return 1;
+    }
+    pfree_contig(page_index, 64);
+    dprintf("test 6 passed.\n");
+    return 0;
+}
+
+// Checks that all words of the page with the given index are zero.
+static int page_is_zero(unsigned int page_index)
+{
+    unsigned int *p = (unsigned int *) (page_index * PAGESIZE);
+    unsigned int i;
+    for (i = 0; i < PAGESIZE / 4; i++) {
+        if (p[i] != 0) {
+            return 0;
+        }
+    }
+    return 1;
+}
+
+int MATOp_test7()
+{
+    unsigned int nr_free, hits, misses, page_index, dirty, i;
+    unsigned int pages[4];
+    unsigned int *p;
+    // Dirty a page and give it back; the refill takes it off the local cache.
+    dirty = palloc();
+    p = (unsigned int *) (dirty * PAGESIZE);
+    p[0] = p[511] = p[1023] = 0xdeadbeef;
+    pfree(dirty);
+    nr_free = palloc_nr_free();
+    if (palloc_zero_refill(1) != 1 || zpool_get_nr() == 0) {
+        dprintf("test 7.1 failed: (%d == 0)\n", zpool_get_nr());
+        return 1;
+    }
+    if (palloc_nr_free() != nr_free) {
+        dprintf("test 7.2 failed: (%d != %d)\n", palloc_nr_free(), nr_free);
+        return 1;
+    }
+    hits = zpool_get_hits();
+    page_index = palloc_zeroed();
+    if (page_index == 0 || !page_is_zero(page_index) || zpool_get_hits() != hits + 1) {
+        dprintf("test 7.3 failed: (%d, %d != %d)\n", page_index, zpool_get_hits(), hits + 1);
+        return 1;
+    }
+    pfree(page_index);
+    // With the pool drained, the page is cleared inline.
+    while (zpool_get_nr() > 0) {
+        pfree(palloc_zeroed());
+    }
+    misses = zpool_get_misses();
+    page_index = palloc();
+    p = (unsigned int *) (page_index * PAGESIZE);
+    p[7] = 0xdeadbeef;
+    pfree(page_index);
+    page_index = palloc_zeroed();
+    if (page_index == 0 || !page_is_zero(page_index) || zpool_get_misses() != misses + 1) {
+        dprintf("test 7.4 failed: (%d, %d != %d)\n", page_index, zpool_get_misses(), misses + 1);
+        return 1;
+    }
+    pfree(page_index);
+    // The pool-only allocation fails on an empty pool, and a batch takes the
+    // pooled pages first and clears the rest inline.
+    if (palloc_prezeroed() != 0) {
+        dprintf("test 7.5 failed: allocated from an empty pool\n");
+        return 1;
+    }
+    if (palloc_zero_refill(2) != 2) {
+        dprintf("test 7.6 failed: (%d != 2)\n", zpool_get_nr());
+        return 1;
+    }
+    hits = zpool_get_hits();
+    misses = zpool_get_misses();
+    if (palloc_zeroed_batch(pages, 4) != 4 || zpool_get_hits() != hits + 2
+        || zpool_get_misses() != misses + 2) {
+        dprintf("test 7.7 failed: (%d != %d, %d != %d)\n", zpool_get_hits(), hits + 2,
+                zpool_get_misses(), misses + 2);
+        return 1;
+    }
+    for (i = 0; i < 4; i++) {
+        if (!page_is_zero(pages[i])) {
+            dprintf("test 7.8 failed: page %d is not zeroed\n", pages[i]);
+            return 1;
+        }
+        pfree(pages[i]);
+    }
+    if (palloc_nr_free() != nr_free || palloc_check() != 0) {
+        dprintf("test 7.9 failed: (%d != %d)\n", palloc_nr_free(), nr_free);
+        return 1;
+    }
+    dprintf("test 7 passed.\n");
+    return 0;
+}
+
+int MATOp_test8()
+{
+    static unsigned int pages[300];
+    unsigned int nr_free = palloc_nr_free();
+    unsigned int i, j;
+    if (palloc_batch(pages, 300) != 300) {
+        dprintf("test 8.1 failed: batch of 300 pages\n");
+        return 1;
+    }
+    for (i = 0; i < 300; i++) {
+        if (at_is_allocated(pages[i]) != 1 || at_get_ref(pages[i]) != 1) {
+            dprintf("test 8.2 failed (i = %d): page %d\n", i, pages[i]);
+            pfree_batch(pages, 300);
+            return 1;
+        }
+        for (j = 0; j < i; j++) {
+            if (pages[j] == pages[i]) {
+                dprintf("test 8.3 failed: page %d returned twice\n", pages[i]);
+                pfree_batch(pages, 300);
+                return 1;
+            }
+        }
+    }
+    if (palloc_nr_free() != nr_free - 300) {
+        dprintf("test 8.4 failed: (%d != %d)\n", palloc_nr_free(), nr_free - 300);
+        pfree_batch(pages, 300);
+        return 1;
+    }
+    pfree_batch(pages, 300);
+    if (palloc_nr_free() != nr_free || palloc_check() != 0) {
+        dprintf("test 8.5 failed: (%d != %d)\n", palloc_nr_free(), nr_free);
+        return 1;
+    }
+    dprintf("test 8 passed.\n");
+    return 0;
+}
+
 /**
  * Write Your Own Test Script (optional)
  *
@@ -57,5 +382,7 @@ int MATOp_test_own()
 
 int test_MATOp()
 {
-    return MATOp_test1() + MATOp_test_own();
+    return MATOp_test1() + MATOp_test2() + MATOp_test3() + MATOp_test4()
+        + MATOp_test5() + MATOp_test6() + MATOp_test7() + MATOp_test8()
+        + MATOp_test_own();
 }
@@ -5,7 +5,7 @@
 
 struct SContainer {
     int quota;      // maximum memory quota of the process
-    int usage;      // the current memory usage of the process
+    volatile unsigned int usage;  // the current memory usage of the process
     int parent;     // the id of the parent process
     int nchildren;  // the number of child processes
     int used;       // whether current container is used by a process
@@ -13,8 +13,74 @@ struct SContainer {
 
 // mCertiKOS supports up to NUM_IDS processes
 static struct SContainer CONTAINER[NUM_IDS];
+// Serializes container_split of the same parent; the usage is updated without locks.
 static spinlock_t container_lks[NUM_IDS];
 
+/**
+ * The container IDs that are not in use, linked through ID_NEXT
+ * (NUM_IDS ends the list). IDs are handed out in increasing order
+ * at first, and the ID of a destroyed container is reused first.
+ */
+static spinlock_t id_lk;
+static unsigned int ID_FREE;
+static unsigned int ID_NEXT[NUM_IDS];
+
+// Takes an unused container ID off the free list. Returns NUM_IDS if there is none.
+static unsigned int container_id_alloc(void)
+{
+    unsigned int id;
+
+    spinlock_acquire(&id_lk);
+    id = ID_FREE;
+    if (id != NUM_IDS) {
+        ID_FREE = ID_NEXT[id];
+    }
+    spinlock_release(&id_lk);
+
+    return id;
+}
+
+// Puts the container ID back onto the free list.
+static void container_id_free(unsigned int id)
+{
+    spinlock_acquire(&id_lk);
+    ID_NEXT[id] = ID_FREE;
+    ID_FREE = id;
+    spinlock_release(&id_lk);
+}
+
+/**
+ * Atomically charges n pages to the usage of process # [id],
+ * given that this will not exceed the quota.
+ * Returns 1 if the pages were charged, and 0 otherwise.
+ */
+static unsigned int container_charge(unsigned int id, unsigned int n)
+{
+    unsigned int usage;
+
+    do {
+        usage = CONTAINER[id].usage;
+        if (usage + n < usage || usage + n > CONTAINER[id].quota) {
+            return 0;
+        }
+    } while (cmpxchg(&CONTAINER[id].usage, usage, usage + n) != usage);
+
+    return 1;
+}
+
+// Atomically takes n pages off the usage of process # [id], stopping at 0.
+static void container_uncharge(unsigned int id, unsigned int n)
+{
+    unsigned int usage;
+
+    do {
+        usage = CONTAINER[id].usage;
+        if (usage == 0) {
+            return;
+        }
+    } while (cmpxchg(&CONTAINER[id].usage, usage, usage >= n ? usage - n : 0) != usage);
+}
+
 /**
  * Initializes the container data for the root process (the one with index 0).
  * The root process is the one that gets spawned first by the kernel.
@@ -22,24 +88,16 @@ static spinlock_t container_lks[NUM_IDS];
 void container_init(unsigned int mbi_addr)
 {
     unsigned int real_quota;
-    unsigned int nps, idx;
+    unsigned int idx;
 
-    pmem_init(mbi_addr);
-    real_quota = 0;
+    palloc_init(mbi_addr);
 
     /**
-     * Compute the available quota and store it into the variable real_quota.
-     * It should be the number of the unallocated pages with the normal permission
-     * in the physical memory allocation table.
+     * The available quota is the number of the unallocated pages with the normal
+     * permission in the physical memory allocation table. Nothing is allocated yet,
+     * so it is the number of normal pages counted by pmem_init.
      */
-    nps = get_nps();
-    idx = 1;
-    while (idx < nps) {
-        if (at_is_norm(idx) && !at_is_allocated(idx)) {
-            real_quota++;
-        }
-        idx++;
-    }
+    real_quota = get_nnorm();
 
     KERN_DEBUG("\nreal quota: %d\n\n", real_quota);
 
@@ -52,6 +110,15 @@ void container_init(unsigned int mbi_addr)
     for (idx = 0; idx < NUM_IDS; idx++) {
         spinlock_init(&container_lks[idx]);
     }
+
+    // Every ID but the one of the root process is free.
+    spinlock_init(&id_lk);
+    ID_FREE = NUM_IDS;
+    for (idx = NUM_IDS - 1; idx > 0; idx--) {
+        CONTAINER[idx].used = 0;
+        ID_NEXT[idx] = ID_FREE;
+        ID_FREE = idx;
+    }
 }
 
 // Get the id of parent process of process # [id].
@@ -87,20 +154,27 @@ unsigned int container_can_consume(unsigned int id, unsigned int n)
 
 /**
  * Dedicates [quota] pages of memory for a new child process.
- * You can assume it is safe to allocate [quota] pages
- * (the check is already done outside before calling this function).
- * Returns the container index for the new child process.
+ * The quota is charged to the parent, so the split fails if the parent can
+ * no longer afford it, e.g., because of the allocations on other CPUs
+ * since the check done outside before calling this function.
+ * The child gets any container ID that is not in use.
+ * Returns the container index for the new child process, or NUM_IDS in the case of failure.
  */
 unsigned int container_split(unsigned int id, unsigned int quota)
 {
-    unsigned int child, nc;
+    unsigned int child;
 
     spinlock_acquire(&container_lks[id]);
 
-    nc = CONTAINER[id].nchildren;
-    child = id * MAX_CHILDREN + 1 + nc;  // container index for the child process
+    if (!container_charge(id, quota)) {
+        spinlock_release(&container_lks[id]);
+        return NUM_IDS;
+    }
 
-    if (NUM_IDS <= child) {
+    child = container_id_alloc();
+    if (child == NUM_IDS) {
+        container_uncharge(id, quota);
+        spinlock_release(&container_lks[id]);
         return NUM_IDS;
     }
 
@@ -113,7 +187,6 @@ unsigned int container_split(unsigned int id, unsigned int quota)
     CONTAINER[child].parent = id;
     CONTAINER[child].nchildren = 0;
 
-    CONTAINER[id].usage += quota;
     CONTAINER[id].nchildren++;
 
     spinlock_release(&container_lks[id]);
@@ -121,38 +194,215 @@ unsigned int container_split(unsigned int id, unsigned int quota)
     return child;
 }
 
+/**
+ * Tears down the container of process # [id], which must not have any pages
+ * or child containers left. The whole quota goes back to the parent,
+ * and the container ID can be reused by the next container_split.
+ * Returns 1 on success, and 0 if the container cannot be torn down.
+ */
+unsigned int container_destroy(unsigned int id)
+{
+    unsigned int parent;
+
+    if (id == 0 || NUM_IDS <= id || CONTAINER[id].used == 0
+        || CONTAINER[id].nchildren != 0 || CONTAINER[id].usage != 0) {
+        return 0;
+    }
+
+    parent = CONTAINER[id].parent;
+
+    spinlock_acquire(&container_lks[parent]);
+
+    CONTAINER[id].used = 0;
+    container_uncharge(parent, CONTAINER[id].quota);
+    CONTAINER[id].quota = 0;
+    CONTAINER[parent].nchildren--;
+
+    spinlock_release(&container_lks[parent]);
+
+    container_id_free(id);
+
+    return 1;
+}
+
 /**
  * Allocates one more page for process # [id], given that this will not exceed the quota.
- * The container structure should be updated accordingly after the allocation.
+ * The page is charged to the container before it is allocated, and the
+ * charge is taken back if there is no free page.
  * Returns the page index of the allocated page, or 0 in the case of failure.
  */
 unsigned int container_alloc(unsigned int id)
 {
-    unsigned int page_index = 0;
+    unsigned int page_index;
 
-    spinlock_acquire(&container_lks[id]);
+    if (!container_charge(id, 1)) {
+        return 0;
+    }
 
-    if (CONTAINER[id].usage + 1 <= CONTAINER[id].quota) {
-        CONTAINER[id].usage++;
-        page_index = palloc();
+    page_index = palloc();
+    if (page_index == 0) {
+        container_uncharge(id, 1);
     }
 
-    spinlock_release(&container_lks[id]);
+    return page_index;
+}
+
+/**
+ * Same as container_alloc, but the page is filled with zeros.
+ * Pre-zeroed pages are used when available, so the caller can skip clearing it.
+ */
+unsigned int container_alloc_zeroed(unsigned int id)
+{
+    unsigned int page_index;
+
+    if (!container_charge(id, 1)) {
+        return 0;
+    }
+
+    page_index = palloc_zeroed();
+    if (page_index == 0) {
+        container_uncharge(id, 1);
+    }
 
     return page_index;
 }
 
-// Frees the physical page and reduces the usage by 1.
-void container_free(unsigned int id, unsigned int page_index)
+/**
+ * Same as container_alloc_zeroed, but the page is only taken from the pool of
+ * pre-zeroed pages, so the caller can tell the pages that were zeroed ahead
+ * of time. Returns 0 if the pool is empty.
+ */
+unsigned int container_alloc_prezeroed(unsigned int id)
 {
-    spinlock_acquire(&container_lks[id]);
+    unsigned int page_index;
+
+    if (!container_charge(id, 1)) {
+        return 0;
+    }
+
+    page_index = palloc_prezeroed();
+    if (page_index == 0) {
+        container_uncharge(id, 1);
+    }
+
+    return page_index;
+}
+
+/**
+ * Takes another reference to the allocated page for process # [id], so that the
+ * page can be shared, given that this will not exceed the quota.
+ * Every reference is charged to the container that holds it.
+ * Returns 1 on success, and 0 otherwise.
+ */
+unsigned int container_share(unsigned int id, unsigned int page_index)
+{
+    if (!at_is_allocated(page_index) || !container_charge(id, 1)) {
+        return 0;
+    }
+
+    at_inc_ref(page_index);
+
+    return 1;
+}
 
+/**
+ * Drops the reference of process # [id] to the physical page and reduces the usage by 1.
+ * The page itself is freed with the last reference.
+ */
+void container_free(unsigned int id, unsigned int page_index)
+{
     if (at_is_allocated(page_index)) {
         pfree(page_index);
-        if (CONTAINER[id].usage > 0) {
-            CONTAINER[id].usage--;
+        container_uncharge(id, 1);
+    }
+}
+
+/**
+ * Allocates n pages for process # [id] at once, given that this will not
+ * exceed the quota, and stores their indices in pages.
+ * The n pages are charged to the container with a single update.
+ * Returns n, or 0 in the case of failure, in which case nothing is allocated.
+ */
+unsigned int container_alloc_batch(unsigned int id, unsigned int *pages, unsigned int n)
+{
+    unsigned int got;
+
+    if (n == 0 || !container_charge(id, n)) {
+        return 0;
+    }
+
+    got = palloc_batch(pages, n);
+    if (got < n) {
+        pfree_batch(pages, got);
+        container_uncharge(id, n);
+        return 0;
+    }
+
+    return n;
+}
+
+// Same as container_alloc_batch, but the pages are filled with zeros (see palloc_zeroed_batch).
+unsigned int container_alloc_zeroed_batch(unsigned int id, unsigned int *pages, unsigned int n)
+{
+    unsigned int got;
+
+    if (n == 0 || !container_charge(id, n)) {
+        return 0;
+    }
+
+    got = palloc_zeroed_batch(pages, n);
+    if (got < n) {
+        pfree_batch(pages, got);
+        container_uncharge(id, n);
+        return 0;
+    }
+
+    return n;
+}
+
+// Drops the references of process # [id] to the n pages in pages and reduces the usage accordingly.
+void container_free_batch(unsigned int id, unsigned int *pages, unsigned int n)
+{
+    unsigned int i, nfree;
+
+    nfree = 0;
+    for (i = 0; i < n; i++) {
+        if (at_is_allocated(pages[i])) {
+            nfree++;
         }
     }
 
-    spinlock_release(&container_lks[id]);
+    pfree_batch(pages, n);
+    container_uncharge(id, nfree);
+}
+
+/**
+ * Allocates npages physically contiguous pages aligned to align pages for
+ * process # [id], given that this will not exceed the quota.
+ * The whole run is charged to the container.
+ * Returns the first page index of the run, or 0 in the case of failure.
+ */
+unsigned int container_alloc_contig(unsigned int id, unsigned int npages, unsigned int align)
+{
+    unsigned int page_index;
+
+    if (!container_charge(id, npages)) {
+        return 0;
+    }
+
+    page_index = palloc_contig(npages, align);
+    if (page_index == 0) {
+        container_uncharge(id, npages);
+    }
+
+    return page_index;
+}
+
+// Frees the npages contiguous pages starting at page_index and reduces the usage by npages.
+void container_free_contig(unsigned int id, unsigned int page_index, unsigned int npages)
+{
+    if (at_is_allocated(page_index)) {
+        pfree_contig(page_index, npages);
+        container_uncharge(id, npages);
+    }
 }
@@ -10,8 +10,17 @@ unsigned int container_get_quota(unsigned int id);
 unsigned int container_get_usage(unsigned int id);
 unsigned int container_can_consume(unsigned int id, unsigned int n);
 unsigned int container_split(unsigned int id, unsigned int quota);
+unsigned int container_destroy(unsigned int id);
 unsigned int container_alloc(unsigned int id);
+unsigned int container_alloc_zeroed(unsigned int id);
+unsigned int container_alloc_prezeroed(unsigned int id);
+unsigned int container_share(unsigned int id, unsigned int page_index);
 void container_free(unsigned int id, unsigned int page_index);
+unsigned int container_alloc_batch(unsigned int id, unsigned int *pages, unsigned int n);
+unsigned int container_alloc_zeroed_batch(unsigned int id, unsigned int *pages, unsigned int n);
+void container_free_batch(unsigned int id, unsigned int *pages, unsigned int n);
+unsigned int container_alloc_contig(unsigned int id, unsigned int npages, unsigned int align);
+void container_free_contig(unsigned int id, unsigned int page_index, unsigned int npages);
 
 #endif  /* _KERN_ */
 
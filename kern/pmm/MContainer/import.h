@@ -4,11 +4,20 @@
 #ifdef _KERN_
 
 unsigned int get_nps(void);
+unsigned int get_nnorm(void);
 unsigned int at_is_norm(unsigned int page_index);
 unsigned int at_is_allocated(unsigned int page_index);
-void pmem_init(unsigned int mbi_addr);
+unsigned int at_inc_ref(unsigned int page_index);
+void palloc_init(unsigned int mbi_addr);
 unsigned int palloc(void);
 void pfree(unsigned int pfree_index);
+unsigned int palloc_prezeroed(void);
+unsigned int palloc_zeroed(void);
+unsigned int palloc_zeroed_batch(unsigned int *pages, unsigned int n);
+unsigned int palloc_batch(unsigned int *pages, unsigned int n);
+void pfree_batch(unsigned int *pages, unsigned int n);
+unsigned int palloc_contig(unsigned int npages, unsigned int align);
+void pfree_contig(unsigned int pfree_index, unsigned int npages);
 
 #endif  /* _KERN_ */
 
@@ -1,6 +1,12 @@
 #include <lib/debug.h>
+#include <lib/x86.h>
+#include <pcpu/PCPUIntro/export.h>
+#include <pmm/MATIntro/export.h>
+#include <pmm/MATOp/export.h>
 #include "export.h"
 
+extern uint32_t pcpu_ncpu(void);
+
 int MContainer_test1()
 {
     if (container_get_quota(0) <= 10000) {
@@ -50,6 +56,256 @@ int MContainer_test2()
     return 0;
 }
 
+int MContainer_test3()
+{
+    unsigned int old_usage = container_get_usage(0);
+    unsigned int page_index = container_alloc_contig(0, 16, 16);
+    if (page_index == 0 || page_index % 16 != 0) {
+        dprintf("test 3.1 failed: (%d == 0 || %d %% 16 != 0)\n", page_index, page_index);
+        container_free_contig(0, page_index, 16);
+        return 1;
+    }
+    if (container_get_usage(0) != old_usage + 16) {
+        dprintf("test 3.2 failed: (%d != %d)\n", container_get_usage(0), old_usage + 16);
+        container_free_contig(0, page_index, 16);
+        return 1;
+    }
+    container_free_contig(0, page_index, 16);
+    if (container_get_usage(0) != old_usage) {
+        dprintf("test 3.3 failed: (%d != %d)\n", container_get_usage(0), old_usage);
+        return 1;
+    }
+    if (container_alloc_contig(0, container_get_quota(0) - old_usage + 1, 1) != 0
+        || container_get_usage(0) != old_usage) {
+        dprintf("test 3.4 failed: a run beyond the quota was allocated\n");
+        return 1;
+    }
+    dprintf("test 3 passed.\n");
+    return 0;
+}
+
+int MContainer_test4()
+{
+    unsigned int old_usage = container_get_usage(0);
+    unsigned int page_index = container_alloc(0);
+    if (page_index == 0 || container_share(0, page_index) != 1) {
+        dprintf("test 4.1 failed: (%d == 0)\n", page_index);
+        return 1;
+    }
+    if (container_get_usage(0) != old_usage + 2) {
+        dprintf("test 4.2 failed: (%d != %d)\n", container_get_usage(0), old_usage + 2);
+        return 1;
+    }
+    // The page stays allocated until the last reference is dropped.
+    container_free(0, page_index);
+    if (at_is_allocated(page_index) != 1 || container_get_usage(0) != old_usage + 1) {
+        dprintf("test 4.3 failed: (%d != 1 || %d != %d)\n", at_is_allocated(page_index),
+                container_get_usage(0), old_usage + 1);
+        return 1;
+    }
+    container_free(0, page_index);
+    if (at_is_allocated(page_index) != 0 || container_get_usage(0) != old_usage) {
+        dprintf("test 4.4 failed: (%d != 0 || %d != %d)\n", at_is_allocated(page_index),
+                container_get_usage(0), old_usage);
+        return 1;
+    }
+    if (container_share(0, page_index) != 0) {
+        dprintf("test 4.5 failed: a free page was shared\n");
+        return 1;
+    }
+    dprintf("test 4 passed.\n");
+    return 0;
+}
+
+/**
+ * The fault stress test: every CPU keeps faulting in pages of the same
+ * container until the quota is hit, then frees some of them and starts
+ * over. The pages held by all CPUs together must never exceed the quota.
+ */
+#define STRESS_QUOTA  64
+#define STRESS_ROUNDS 2000
+
+static volatile unsigned int stress_id;
+static volatile unsigned int stress_start;
+static volatile unsigned int stress_joined;
+static volatile unsigned int stress_done;
+static volatile unsigned int stress_held;     // pages held by all CPUs together
+static volatile unsigned int stress_overrun;  // whether the quota was ever exceeded
+static unsigned int stress_pages[NUM_CPUS][STRESS_QUOTA + 1];
+
+static void stress_add(volatile unsigned int *counter, int n)
+{
+    unsigned int old;
+    do {
+        old = *counter;
+    } while (cmpxchg(counter, old, old + n) != old);
+}
+
+static void MContainer_stress(void)
+{
+    unsigned int *pages = stress_pages[get_pcpu_idx()];
+    unsigned int round, n, page_index;
+
+    n = 0;
+    for (round = 0; round < STRESS_ROUNDS; round++) {
+        while (n <= STRESS_QUOTA && (page_index = container_alloc(stress_id)) != 0) {
+            pages[n++] = page_index;
+            stress_add(&stress_held, 1);
+            if (stress_held > STRESS_QUOTA || n > STRESS_QUOTA) {
+                stress_overrun = 1;
+            }
+        }
+        if (container_get_usage(stress_id) > STRESS_QUOTA) {
+            stress_overrun = 1;
+        }
+        // Keep a varying number of pages so that the CPUs interleave differently.
+        while (n > round % 4) {
+            stress_add(&stress_held, -1);
+            container_free(stress_id, pages[--n]);
+        }
+    }
+    while (n > 0) {
+        stress_add(&stress_held, -1);
+        container_free(stress_id, pages[--n]);
+    }
+}
+
+// Runs the fault stress test on an application processor.
+void test_MContainer_ap(void)
+{
+    stress_add(&stress_joined, 1);
+    while (stress_start == 0) {
+        pause();
+    }
+    MContainer_stress();
+    stress_add(&stress_done, 1);
+}
+
+int MContainer_test5()
+{
+    unsigned int ncpu = pcpu_ncpu();
+    unsigned int nr_free = palloc_nr_free();
+
+    stress_id = container_split(1, STRESS_QUOTA);
+    if (stress_id == NUM_IDS) {
+        dprintf("test 5.1 failed: (%d == %d)\n", stress_id, NUM_IDS);
+        return 1;
+    }
+    while (stress_joined < ncpu - 1) {
+        pause();
+    }
+    stress_start = 1;
+    MContainer_stress();
+    while (stress_done < ncpu - 1) {
+        pause();
+    }
+    if (stress_overrun != 0) {
+        dprintf("test 5.2 failed: the quota of %d pages was exceeded\n", STRESS_QUOTA);
+        return 1;
+    }
+    if (container_get_usage(stress_id) != 0 || palloc_nr_free() != nr_free) {
+        dprintf("test 5.3 failed: (%d != 0 || %d != %d)\n",
+                container_get_usage(stress_id), palloc_nr_free(), nr_free);
+        return 1;
+    }
+    // Gives the quota back to container 1, which the later layers' tests use.
+    if (container_destroy(stress_id) != 1) {
+        dprintf("test 5.4 failed: container_destroy\n");
+        return 1;
+    }
+    dprintf("test 5 passed (%d CPUs).\n", ncpu);
+    return 0;
+}
+
+/**
+ * Benchmark: faults in the pages of a freshly spawned process, one
+ * container_alloc per page versus a single container_alloc_batch,
+ * and checks that both charge the container the same way.
+ */
+#define SPAWN_PAGES 256
+
+int MContainer_test6()
+{
+    static unsigned int pages[SPAWN_PAGES];
+    unsigned int old_usage = container_get_usage(0);
+    unsigned long long t0, t1, t2, t3;
+    unsigned int i;
+
+    t0 = rdtsc();
+    for (i = 0; i < SPAWN_PAGES; i++) {
+        pages[i] = container_alloc(0);
+    }
+    t1 = rdtsc();
+    if (container_get_usage(0) != old_usage + SPAWN_PAGES) {
+        dprintf("test 6.1 failed: (%d != %d)\n", container_get_usage(0), old_usage + SPAWN_PAGES);
+        return 1;
+    }
+    for (i = 0; i < SPAWN_PAGES; i++) {
+        container_free(0, pages[i]);
+    }
+
+    t2 = rdtsc();
+    if (container_alloc_batch(0, pages, SPAWN_PAGES) != SPAWN_PAGES) {
+        dprintf("test 6.2 failed: batch of %d pages\n", SPAWN_PAGES);
+        return 1;
+    }
+    t3 = rdtsc();
+    if (container_get_usage(0) != old_usage + SPAWN_PAGES) {
+        dprintf("test 6.3 failed: (%d != %d)\n", container_get_usage(0), old_usage + SPAWN_PAGES);
+        return 1;
+    }
+    container_free_batch(0, pages, SPAWN_PAGES);
+    if (container_get_usage(0) != old_usage) {
+        dprintf("test 6.4 failed: (%d != %d)\n", container_get_usage(0), old_usage);
+        return 1;
+    }
+    if (container_alloc_batch(0, pages, container_get_quota(0) - old_usage + 1) != 0
+        || container_get_usage(0) != old_usage) {
+        dprintf("test 6.5 failed: a batch beyond the quota was allocated\n");
+        return 1;
+    }
+
+    dprintf("spawn of %d pages: one by one %llu cycles, batched %llu cycles.\n",
+            SPAWN_PAGES, t1 - t0, t3 - t2);
+    dprintf("test 6 passed.\n");
+    return 0;
+}
+
+int MContainer_test7()
+{
+    unsigned int old_usage = container_get_usage(0);
+    unsigned int old_nchildren = container_get_nchildren(0);
+    unsigned int chid, chid2, page_index, i;
+    chid = container_split(0, 10);
+    page_index = container_alloc(chid);
+    // A container with pages left cannot be torn down.
+    if (chid == NUM_IDS || page_index == 0 || container_destroy(chid) != 0) {
+        dprintf("test 7.1 failed: (%d == %d || %d == 0)\n", chid, NUM_IDS, page_index);
+        return 1;
+    }
+    container_free(chid, page_index);
+    if (container_destroy(chid) != 1 || container_get_usage(0) != old_usage
+        || container_get_nchildren(0) != old_nchildren) {
+        dprintf("test 7.2 failed: (%d != %d || %d != %d)\n", container_get_usage(0), old_usage,
+                container_get_nchildren(0), old_nchildren);
+        return 1;
+    }
+    // The ID is recycled, so many more containers than IDs can come and go.
+    for (i = 0; i < 4 * NUM_IDS; i++) {
+        chid2 = container_split(0, 10);
+        if (chid2 != chid || container_destroy(chid2) != 1) {
+            dprintf("test 7.3 failed (i = %d): (%d != %d)\n", i, chid2, chid);
+            return 1;
+        }
+    }
+    if (container_get_usage(0) != old_usage || container_destroy(0) != 0) {
+        dprintf("test 7.4 failed: (%d != %d)\n", container_get_usage(0), old_usage);
+        return 1;
+    }
+    dprintf("test 7 passed.\n");
+    return 0;
+}
+
 /**
  * Write Your Own Test Script (optional)
  *
@@ -72,5 +328,7 @@ int MContainer_test_own()
 
 int test_MContainer()
 {
-    return MContainer_test1() + MContainer_test2() + MContainer_test_own();
+    return MContainer_test1() + MContainer_test2() + MContainer_test3() + MContainer_test4()
+        + MContainer_test5() + MContainer_test6()
+        + MContainer_test7() + MContainer_test_own();
 }
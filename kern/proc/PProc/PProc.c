@@ -2,8 +2,11 @@
 #include <lib/debug.h>
 #include <lib/gcc.h>
 #include <lib/seg.h>
+#include <lib/thread.h>
 #include <lib/trap.h>
 #include <lib/x86.h>
+#include <lib/vmregion.h>
+#include <lib/wset.h>
 #include <pcpu/PCPUIntro/export.h>
 
 #include "import.h"
@@ -17,6 +20,9 @@ void proc_start_user(void)
     unsigned int cur_pid = get_curid();
     unsigned int cpu_idx = get_pcpu_idx();
 
+    // A new thread does not return from thread_yield, which reaps otherwise.
+    thread_reap();
+
     kstack_switch(cur_pid);
     set_pdir_base(cur_pid);
     last_active[cpu_idx] = cur_pid;
@@ -24,6 +30,11 @@ void proc_start_user(void)
     trap_return((void *) &uctx_pool[cur_pid]);
 }
 
+/**
+ * Creates a process with the given quota that runs the ELF image [elf_addr].
+ * It returns the process ID of the new process, or NUM_IDS in the case of
+ * error, e.g., when the image cannot be loaded (see elf_load).
+ */
 unsigned int proc_create(void *elf_addr, unsigned int quota)
 {
     unsigned int pid, id;
@@ -32,7 +43,14 @@ unsigned int proc_create(void *elf_addr, unsigned int quota)
     pid = thread_spawn((void *) proc_start_user, id, quota);
 
     if (pid != NUM_IDS) {
-        elf_load(elf_addr, pid);
+        if (elf_load(elf_addr, pid) != 0) {
+            // The child has not run yet, and has no pages.
+            tqueue_remove(NUM_IDS + get_pcpu_idx(), pid);
+            tcb_set_state(pid, TSTATE_DEAD);
+            container_destroy(pid);
+            return NUM_IDS;
+        }
+        wset_reset(pid);
 
         uctx_pool[pid].es = CPU_GDT_UDATA | 3;
         uctx_pool[pid].ds = CPU_GDT_UDATA | 3;
@@ -47,3 +65,55 @@ unsigned int proc_create(void *elf_addr, unsigned int quota)
 
     return pid;
 }
+
+/**
+ * Creates a copy of the current process with the given quota. The child
+ * shares the pages of the parent copy-on-write (see pdir_copy_cow), and
+ * starts from the user context [tf] of the parent.
+ * It returns the process ID of the child, or NUM_IDS in the case of error.
+ */
+unsigned int proc_fork(tf_t *tf, unsigned int quota)
+{
+    unsigned int pid, id;
+
+    id = get_curid();
+    pid = thread_spawn((void *) proc_start_user, id, quota);
+
+    if (pid != NUM_IDS) {
+        if (pdir_copy_cow(id, pid) == MagicNumber) {
+            // The child has not run yet, so it can be dropped from the queue,
+            // along with the pages shared so far and its container.
+            tqueue_remove(NUM_IDS + get_pcpu_idx(), pid);
+            tcb_set_state(pid, TSTATE_DEAD);
+            pdir_free(pid);
+            container_destroy(pid);
+            return NUM_IDS;
+        }
+
+        vmr_copy(id, pid);
+        wset_reset(pid);
+        uctx_pool[pid] = *tf;
+
+        seg_init_proc(get_pcpu_idx(), pid);
+    }
+
+    return pid;
+}
+
+/**
+ * Terminates the current process: gives all the pages of its page structure
+ * back to its container (see pdir_free), and switches to the next thread.
+ * The container itself, and its quota, goes back to the parent once the
+ * thread is no longer running (see thread_reap).
+ * It does not return.
+ */
+void proc_exit(void)
+{
+    unsigned int cur_pid = get_curid();
+
+    // The page structure of the process must not stay loaded.
+    pdir_use_kern();
+    pdir_free(cur_pid);
+
+    thread_exit();
+}
@@ -3,8 +3,12 @@
 
 #ifdef _KERN_
 
+#include <lib/trap.h>
+
 unsigned int proc_create(void *elf_addr, unsigned int quota);
 void proc_start_user(void);
+unsigned int proc_fork(tf_t *tf, unsigned int quota);
+void proc_exit(void);
 
 #endif  /* _KERN_ */
 
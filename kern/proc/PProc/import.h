@@ -7,6 +7,14 @@ unsigned int get_curid(void);
 void set_pdir_base(unsigned int index);
 unsigned int thread_spawn(void *entry, unsigned int id,
                           unsigned int quota);
+unsigned int pdir_copy_cow(unsigned int from, unsigned int to);
+void tqueue_remove(unsigned int chid, unsigned int pid);
+void tcb_set_state(unsigned int pid, unsigned int state);
+unsigned int pdir_free(unsigned int proc_index);
+void pdir_use_kern(void);
+unsigned int container_destroy(unsigned int id);
+void thread_reap(void);
+void thread_exit(void);
 
 #endif  /* _KERN_ */
 
@@ -7,11 +7,33 @@
 
 #include "import.h"
 
+/**
+ * The thread that exited last on each CPU, or NUM_IDS. Its container is torn
+ * down by the next thread that runs on the CPU (see thread_reap), once the
+ * kernel stack and the context of the exited thread are no longer in use,
+ * since tearing down the container lets its ID be reused.
+ */
+static unsigned int zombie[NUM_CPUS];
+
+/**
+ * The milliseconds of its time slice the running thread of each CPU has used.
+ * Only the CPU itself updates its entry, with interrupts off, and a thread
+ * gets a fresh slice whenever it is switched in.
+ */
+static unsigned int sched_ticks[NUM_CPUS];
+
 void thread_init(unsigned int mbi_addr)
 {
+    unsigned int cpu_idx;
+
     tqueue_init(mbi_addr);
     set_curid(0);
     tcb_set_state(0, TSTATE_RUN);
+
+    for (cpu_idx = 0; cpu_idx < NUM_CPUS; cpu_idx++) {
+        zombie[cpu_idx] = NUM_IDS;
+        sched_ticks[cpu_idx] = 0;
+    }
 }
 
 /**
@@ -31,6 +53,30 @@ unsigned int thread_spawn(void *entry, unsigned int id, unsigned int quota)
     return pid;
 }
 
+/**
+ * Tears down the container of the thread that exited last on the current CPU,
+ * giving its quota back to its parent. A parent that exited before its
+ * children keeps its container until the last of them is reaped, so the
+ * containers are torn down up the chain as far as possible.
+ * Every thread calls it after it switches in.
+ */
+void thread_reap(void)
+{
+    unsigned int cpu_idx = get_pcpu_idx();
+    unsigned int pid = zombie[cpu_idx];
+    unsigned int parent;
+
+    zombie[cpu_idx] = NUM_IDS;
+
+    while (pid != NUM_IDS && pid != 0 && tcb_get_state(pid) == TSTATE_DEAD) {
+        parent = container_get_parent(pid);
+        if (container_destroy(pid) == 0) {
+            break;
+        }
+        pid = parent;
+    }
+}
+
 /**
  * Yield to the next thread in the ready queue.
  * You should set the currently running thread state as ready,
@@ -51,8 +97,54 @@ void thread_yield(void)
     new_cur_pid = tqueue_dequeue(NUM_IDS + get_pcpu_idx());
     tcb_set_state(new_cur_pid, TSTATE_RUN);
     set_curid(new_cur_pid);
+    sched_ticks[get_pcpu_idx()] = 0;
 
     if (old_cur_pid != new_cur_pid) {
         kctx_switch(old_cur_pid, new_cur_pid);
+        thread_reap();
+    }
+}
+
+/**
+ * Terminates the current thread: marks it dead and switches to the next thread
+ * in the ready queue, without putting it back into the queue. The thread must
+ * have given back all the pages of its container.
+ * It does not return.
+ */
+void thread_exit(void)
+{
+    unsigned int new_cur_pid;
+    unsigned int old_cur_pid = get_curid();
+
+    tcb_set_state(old_cur_pid, TSTATE_DEAD);
+
+    new_cur_pid = tqueue_dequeue(NUM_IDS + get_pcpu_idx());
+    if (new_cur_pid == NUM_IDS) {
+        KERN_PANIC("No thread left to run on CPU %d.\n", get_pcpu_idx());
+    }
+
+    zombie[get_pcpu_idx()] = old_cur_pid;
+    tcb_set_state(new_cur_pid, TSTATE_RUN);
+    set_curid(new_cur_pid);
+    sched_ticks[get_pcpu_idx()] = 0;
+    kctx_switch(old_cur_pid, new_cur_pid);
+
+    KERN_PANIC("An exited thread is running again.\n");
+}
+
+/**
+ * Charges a timer tick to the running thread of the current CPU, and preempts
+ * it with thread_yield once it has used up its SCHED_SLICE milliseconds.
+ * It is called by the timer interrupt handler, once the interrupt has been
+ * acknowledged. The preempted thread resumes from here when it is switched
+ * back in, on its own kernel stack, and finishes its trap from there.
+ */
+void sched_update(void)
+{
+    unsigned int cpu_idx = get_pcpu_idx();
+
+    sched_ticks[cpu_idx] += 1000 / LAPIC_TIMER_INTR_FREQ;
+    if (sched_ticks[cpu_idx] >= SCHED_SLICE) {
+        thread_yield();
     }
 }
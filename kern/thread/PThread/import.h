@@ -6,6 +6,7 @@
 unsigned int kctx_new(void *entry, unsigned int id, unsigned int quota);
 void kctx_switch(unsigned int from_pid, unsigned int to_pid);
 
+unsigned int tcb_get_state(unsigned int pid);
 void tcb_set_state(unsigned int pid, unsigned int state);
 
 void tqueue_init(unsigned int mbi_addr);
@@ -17,6 +18,9 @@ void set_curid(unsigned int curid);
 
 void tcb_set_cpu(unsigned int pid, unsigned int cpu);
 
+unsigned int container_get_parent(unsigned int id);
+unsigned int container_destroy(unsigned int id);
+
 #endif  /* _KERN_ */
 
 #endif  /* !_KERN_THREAD_PTHREAD_H_ */
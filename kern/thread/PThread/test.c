@@ -1,8 +1,12 @@
 #include <lib/x86.h>
 #include <lib/debug.h>
 #include <lib/thread.h>
+#include <pmm/MContainer/export.h>
 #include <thread/PTCBIntro/export.h>
 #include <thread/PTQueueIntro/export.h>
+#include <thread/PTQueueInit/export.h>
+#include <thread/PCurID/export.h>
+#include <vmm/MPTIntro/export.h>
 #include "export.h"
 
 int PThread_test1()
@@ -19,10 +23,150 @@ int PThread_test1()
                 tqueue_get_tail(NUM_IDS), chid);
         return 1;
     }
+    tqueue_remove(NUM_IDS, chid);
+    tcb_set_state(chid, TSTATE_DEAD);
     dprintf("test 1 passed.\n");
     return 0;
 }
 
+/**
+ * Context switch benchmark: two threads hand the CPU back and forth with
+ * thread_yield, each loading its own page structure like the return to user
+ * mode does, and touching kernel memory spread over several 4MB pages.
+ * It runs once with the kernel mappings global (CR4.PGE) and once without.
+ */
+#define PP_ROUNDS 1000
+#define PP_PDE    16  // the first page directory entry of the touched region
+#define PP_NPDE   16
+
+static volatile unsigned int pp_done;
+
+static void pp_touch(void)
+{
+    volatile unsigned int *p;
+    unsigned int pde;
+
+    for (pde = PP_PDE; pde < PP_PDE + PP_NPDE; pde++) {
+        p = (volatile unsigned int *) (pde << 22);
+        (void) *p;
+    }
+}
+
+static void pp_partner(void)
+{
+    while (1) {
+        set_pdir_base(get_curid());
+        pp_touch();
+        pp_done++;
+        thread_yield();
+    }
+}
+
+static unsigned long long pp_run(void)
+{
+    unsigned long long start;
+    unsigned int i;
+
+    start = rdtsc();
+    for (i = 0; i < PP_ROUNDS; i++) {
+        set_pdir_base(0);
+        pp_touch();
+        thread_yield();
+    }
+    return rdtsc() - start;
+}
+
+int PThread_test2()
+{
+    unsigned int chid, cr4 = rcr4();
+    unsigned long long t_global, t_flush;
+
+    chid = thread_spawn(pp_partner, 0, 1000);
+    if (chid == NUM_IDS) {
+        dprintf("test 2.1 failed: cannot spawn the partner thread\n");
+        return 1;
+    }
+
+    pp_done = 0;
+    lcr4(cr4 | CR4_PGE);
+    pp_run();  // warm up
+    t_global = pp_run();
+    lcr4(cr4 & ~CR4_PGE);
+    t_flush = pp_run();
+    lcr4(cr4);
+    set_pdir_base(0);
+
+    tqueue_remove(NUM_IDS, chid);
+    tcb_set_state(chid, TSTATE_DEAD);
+    container_destroy(chid);
+
+    if (pp_done != 3 * PP_ROUNDS) {
+        dprintf("test 2.2 failed: (%d != %d)\n", pp_done, 3 * PP_ROUNDS);
+        return 1;
+    }
+    dprintf("thread_yield ping-pong x %d: global kernel pages %llu cycles, "
+            "no global pages %llu cycles.\n", PP_ROUNDS, t_global, t_flush);
+    dprintf("test 2 passed.\n");
+    return 0;
+}
+
+static volatile unsigned int sched_ran;
+
+static void sched_partner(void)
+{
+    while (1) {
+        sched_ran++;
+        thread_yield();
+    }
+}
+
+int PThread_test3()
+{
+    unsigned int chid, i;
+
+    chid = thread_spawn(sched_partner, 0, 1000);
+    if (chid == NUM_IDS) {
+        dprintf("test 3.1 failed: cannot spawn the partner thread\n");
+        return 1;
+    }
+
+    // Starts from a fresh slice.
+    thread_yield();
+    sched_ran = 0;
+    for (i = 1; i < SCHED_SLICE; i++) {
+        sched_update();
+    }
+    if (sched_ran != 0) {
+        dprintf("test 3.2 failed: (%d != 0)\n", sched_ran);
+        tqueue_remove(NUM_IDS, chid);
+        tcb_set_state(chid, TSTATE_DEAD);
+        container_destroy(chid);
+        return 1;
+    }
+    // The slice is used up, so the partner runs once and yields back.
+    sched_update();
+    if (sched_ran != 1) {
+        dprintf("test 3.3 failed: (%d != 1)\n", sched_ran);
+        tqueue_remove(NUM_IDS, chid);
+        tcb_set_state(chid, TSTATE_DEAD);
+        container_destroy(chid);
+        return 1;
+    }
+    // Switching back in gave this thread a fresh slice.
+    for (i = 1; i < SCHED_SLICE; i++) {
+        sched_update();
+    }
+    tqueue_remove(NUM_IDS, chid);
+    tcb_set_state(chid, TSTATE_DEAD);
+    container_destroy(chid);
+    if (sched_ran != 1) {
+        dprintf("test 3.4 failed: (%d != 1)\n", sched_ran);
+        return 1;
+    }
+    dprintf("test 3 passed.\n");
+    return 0;
+}
+
 /**
  * Write Your Own Test Script (optional)
  *
@@ -45,5 +189,5 @@ int PThread_test_own()
 
 int test_PThread()
 {
-    return PThread_test1() + PThread_test_own();
+    return PThread_test1() + PThread_test2() + PThread_test3() + PThread_test_own();
 }
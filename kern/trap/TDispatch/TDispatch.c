@@ -67,6 +67,124 @@ void syscall_dispatch(tf_t *tf)
     case SYS_consume:
         sys_consume(tf);
         break;
+    case SYS_getpid:
+        /*
+         * Get the process ID of the caller.
+         *
+         * Parameters:
+         *   None.
+         *
+         * Return:
+         *   the process ID of the caller
+         *
+         * Error:
+         *   None.
+         */
+        sys_getpid(tf);
+        break;
+    case SYS_fork:
+        /*
+         * Create a copy of the caller that shares its pages copy-on-write.
+         *
+         * Parameters:
+         *   a[0]: the quota
+         *
+         * Return:
+         *   the process ID of the child in the caller, 0 in the child
+         *
+         * Error:
+         *   E_INVAL_PID
+         */
+        sys_fork(tf);
+        break;
+    case SYS_fault_around:
+        /*
+         * Set the fault-around window of the caller, and get its page fault
+         * counters.
+         *
+         * Parameters:
+         *   a[0]: the number of pages of the window, 0 to keep it
+         *         (at most the quota of the caller)
+         *
+         * Return:
+         *   the previous window
+         *   the number of page faults taken by the caller
+         *   the number of pages mapped by them
+         *
+         * Error:
+         *   None.
+         */
+        sys_fault_around(tf);
+        break;
+    case SYS_mmap:
+        /*
+         * Map anonymous memory, allocated zeroed when it is first touched.
+         *
+         * Parameters:
+         *   a[0]: the page aligned address, 0 to let the kernel choose it
+         *   a[1]: the length in bytes
+         *   a[2]: MMAP_WRITE if the memory is writable, MMAP_LARGE if it is
+         *         mapped with 4MB pages where possible
+         *
+         * Return:
+         *   the address of the memory
+         *
+         * Error:
+         *   E_INVAL_ADDR
+         */
+        sys_mmap(tf);
+        break;
+    case SYS_munmap:
+        /*
+         * Unmap memory, and give its pages back to the caller's container.
+         *
+         * Parameters:
+         *   a[0]: the page aligned address
+         *   a[1]: the length in bytes
+         *
+         * Return:
+         *   the number of pages given back
+         *
+         * Error:
+         *   E_INVAL_ADDR
+         */
+        sys_munmap(tf);
+        break;
+    case SYS_exit:
+        /*
+         * Terminate the caller, and give its memory back to its parent.
+         *
+         * Parameters:
+         *   a[0]: the exit status, currently ignored
+         *
+         * Return:
+         *   None, it does not return.
+         *
+         * Error:
+         *   None.
+         */
+        sys_exit(tf);
+        break;
+    case SYS_wset:
+        /*
+         * Get the working set estimates of a process, in pages.
+         *
+         * Parameters:
+         *   a[0]: the process ID, 0 for the caller
+         *   a[1]: nonzero to scan the caller's pages first
+         *
+         * Return:
+         *   the moving average of the pages accessed per scan period
+         *   the pages accessed in both of the last two periods
+         *   the pages written in the last period
+         *   the pages mapped
+         *   the largest number of pages accessed in a period
+         *
+         * Error:
+         *   E_INVAL_PID
+         */
+        sys_wset(tf);
+        break;
     default:
         syscall_set_errno(tf, E_INVAL_CALLNR);
     }
@@ -10,6 +10,13 @@ void sys_spawn(tf_t *tf);
 void sys_yield(tf_t *tf);
 void sys_produce(tf_t *tf);
 void sys_consume(tf_t *tf);
+void sys_getpid(tf_t *tf);
+void sys_fork(tf_t *tf);
+void sys_fault_around(tf_t *tf);
+void sys_mmap(tf_t *tf);
+void sys_munmap(tf_t *tf);
+void sys_exit(tf_t *tf);
+void sys_wset(tf_t *tf);
 
 #endif  /* _KERN_ */
 
@@ -4,6 +4,8 @@
 #include <lib/x86.h>
 #include <lib/trap.h>
 #include <lib/syscall.h>
+#include <lib/vmregion.h>
+#include <lib/wset.h>
 #include <dev/intr.h>
 #include <pcpu/PCPUIntro/export.h>
 
@@ -141,3 +143,135 @@ void sys_consume(tf_t *tf)
     }
     syscall_set_errno(tf, E_SUCC);
 }
+
+/**
+ * Returns the process ID of the caller.
+ * It does nothing else, so it measures the cost of a system call round trip.
+ */
+void sys_getpid(tf_t *tf)
+{
+    syscall_set_errno(tf, E_SUCC);
+    syscall_set_retval1(tf, get_curid());
+}
+
+/**
+ * Creates a copy of the calling process with the given quota, which shares
+ * the pages of the caller copy-on-write.
+ * The caller gets the process ID of the child, and the child gets 0.
+ */
+void sys_fork(tf_t *tf)
+{
+    unsigned int new_pid;
+    unsigned int quota;
+
+    quota = syscall_get_arg2(tf);
+
+    // The child resumes from a copy of this context.
+    syscall_set_errno(tf, E_SUCC);
+    syscall_set_retval1(tf, 0);
+
+    new_pid = proc_fork(tf, quota);
+
+    if (new_pid == NUM_IDS) {
+        syscall_set_errno(tf, E_INVAL_PID);
+        syscall_set_retval1(tf, NUM_IDS);
+    } else {
+        syscall_set_errno(tf, E_SUCC);
+        syscall_set_retval1(tf, new_pid);
+    }
+}
+
+/**
+ * Sets the number of pages a page fault of the caller maps around the
+ * faulting page when the argument is not 0 (bounded by the quota of the
+ * caller), and returns the previous window, along with the number of page
+ * faults taken by the caller and the pages they mapped.
+ */
+void sys_fault_around(tf_t *tf)
+{
+    unsigned int window = syscall_get_arg2(tf);
+    unsigned int cur_pid = get_curid();
+
+    syscall_set_retval1(tf, window != 0 ? vmr_set_window(cur_pid, window)
+                                        : vmr_get_window(cur_pid));
+    syscall_set_retval2(tf, vmr_get_nfaults(cur_pid));
+    syscall_set_retval3(tf, vmr_get_npages(cur_pid));
+    syscall_set_errno(tf, E_SUCC);
+}
+
+void sys_mmap(tf_t *tf)
+{
+    unsigned int va = syscall_get_arg2(tf);
+    unsigned int len = syscall_get_arg3(tf);
+    unsigned int flags = syscall_get_arg4(tf);
+    unsigned int perm = PTE_P | PTE_U;
+
+    if (flags & MMAP_WRITE)
+        perm |= PTE_W;
+
+    va = vmr_mmap(get_curid(), va, len, perm,
+                  (flags & MMAP_LARGE) ? TRUE : FALSE);
+    if (va == 0) {
+        syscall_set_errno(tf, E_INVAL_ADDR);
+        return;
+    }
+
+    syscall_set_retval1(tf, va);
+    syscall_set_errno(tf, E_SUCC);
+}
+
+void sys_munmap(tf_t *tf)
+{
+    unsigned int va = syscall_get_arg2(tf);
+    unsigned int len = syscall_get_arg3(tf);
+    int nfree;
+
+    nfree = vmr_munmap(get_curid(), va, len);
+    if (nfree < 0) {
+        syscall_set_errno(tf, E_INVAL_ADDR);
+        return;
+    }
+
+    syscall_set_retval1(tf, nfree);
+    syscall_set_errno(tf, E_SUCC);
+}
+
+/**
+ * Terminates the caller. The exit status is ignored, as there is no wait
+ * system call to collect it.
+ */
+void sys_exit(tf_t *tf)
+{
+    proc_exit();
+}
+
+/**
+ * Returns the working set estimates of process # [pid], or of the caller when
+ * it is 0, in pages. The caller can have its own pages scanned first, so that
+ * the estimates cover the accesses since the last scan; the pages of another
+ * process are only scanned by the timer, on its own CPU.
+ */
+void sys_wset(tf_t *tf)
+{
+    unsigned int pid = syscall_get_arg2(tf);
+    unsigned int scan = syscall_get_arg3(tf);
+    struct wset ws;
+
+    if (pid == 0)
+        pid = get_curid();
+    if (NUM_IDS <= pid) {
+        syscall_set_errno(tf, E_INVAL_PID);
+        return;
+    }
+
+    if (scan && pid == get_curid())
+        wset_scan(pid);
+    wset_get(pid, &ws);
+
+    syscall_set_retval1(tf, ws.avg);
+    syscall_set_retval2(tf, ws.hot);
+    syscall_set_retval3(tf, ws.dirty);
+    syscall_set_retval4(tf, ws.resident);
+    syscall_set_retval5(tf, ws.peak);
+    syscall_set_errno(tf, E_SUCC);
+}
@@ -21,7 +21,9 @@ void syscall_set_retval5(tf_t *tf, unsigned int retval);
 unsigned int container_can_consume(unsigned int curid, unsigned int quota);
 unsigned int container_get_nchildren(unsigned int curid);
 unsigned int proc_create(void *elf_addr, unsigned int quota);
+unsigned int proc_fork(tf_t *tf, unsigned int quota);
 void thread_yield(void);
+void proc_exit(void);
 
 #endif  /* _KERN_ */
 
@@ -4,6 +4,8 @@
 #include <lib/debug.h>
 #include <lib/kstack.h>
 #include <lib/x86.h>
+#include <lib/vmregion.h>
+#include <lib/wset.h>
 #include <dev/intr.h>
 #include <pcpu/PCPUIntro/export.h>
 
@@ -49,6 +51,23 @@ void default_exception_handler(tf_t *tf)
     KERN_PANIC("Trap %d @ 0x%08x.\n", tf->trapno, tf->eip);
 }
 
+/**
+ * A page fault the process cannot recover from terminates it (see proc_exit),
+ * unless it was taken in the kernel, which is a bug of the kernel.
+ */
+static void pgflt_fail(tf_t *tf, const char *reason, unsigned int fault_va)
+{
+    if ((tf->cs & 3) == 0) {
+        trap_dump(tf);
+        KERN_PANIC("%s: va = 0x%08x, errno = 0x%08x.\n", reason, fault_va,
+                   tf->err);
+    }
+
+    KERN_WARN("Process %d killed, %s: va = 0x%08x, errno = 0x%08x, eip = 0x%08x.\n",
+              get_curid(), reason, fault_va, tf->err, tf->eip);
+    proc_exit();
+}
+
 void pgflt_handler(tf_t *tf)
 {
     unsigned int cur_pid;
@@ -64,14 +83,20 @@ void pgflt_handler(tf_t *tf)
     //            fault_va, errno, cur_pid, uctx_pool[cur_pid].eip);
 
     if (errno & PFE_PR) {
-        KERN_PANIC("Permission denied: va = 0x%08x, errno = 0x%08x.\n",
-                   fault_va, errno);
+        // A write to a page shared copy-on-write after fork.
+        if ((errno & PFE_WR) && copy_on_write(cur_pid, fault_va) == 0) {
+            return;
+        }
+        pgflt_fail(tf, "permission denied", fault_va);
         return;
     }
 
-    if (alloc_page(cur_pid, fault_va, PTE_W | PTE_U | PTE_P) == MagicNumber) {
-        KERN_PANIC("Page allocation failed: va = 0x%08x, errno = 0x%08x.\n",
-                   fault_va, errno);
+    // Fills the page from the region of the process it belongs to, along
+    // with its neighbours in the fault-around window.
+    if (vmr_find(cur_pid, fault_va) == NULL) {
+        pgflt_fail(tf, "access outside any region", fault_va);
+    } else if (vmr_pgflt(cur_pid, fault_va) == MagicNumber) {
+        pgflt_fail(tf, "page allocation failed", fault_va);
     }
 }
 
@@ -92,8 +117,25 @@ static int spurious_intr_handler(void)
     return 0;
 }
 
+/**
+ * Interrupts are off in the kernel, so the timer always interrupts a process.
+ * The interrupt is acknowledged before the process may be preempted, as the
+ * next thread does not return through this handler. The rest of the trap
+ * (see trap) restores the kernel stack and the page structure of the
+ * process when it runs again.
+ */
 static int timer_intr_handler(void)
 {
+    wset_tick(get_curid());
+    intr_eoi();
+    sched_update();
+    return 0;
+}
+
+// Another CPU changed the page structure this CPU has loaded.
+static int ipi_invalc_handler(void)
+{
+    tlb_shootdown_handle();
     intr_eoi();
     return 0;
 }
@@ -117,6 +159,9 @@ void interrupt_handler(tf_t *tf)
     case T_IRQ0 + IRQ_TIMER:
         timer_intr_handler();
         break;
+    case T_IPI0 + IPI_INVALC:
+        ipi_invalc_handler();
+        break;
     default:
         default_intr_handler();
     }
@@ -134,7 +179,15 @@ void trap(tf_t *tf)
 
     if (last_pid != 0)
     {
-        set_pdir_base(0);  // switch to the kernel's page table
+        /**
+         * The kernel is identity mapped in every page structure, so the trap
+         * can be handled on the page structure of the process. The kernel's
+         * page structure is only loaded once the handler accesses the physical
+         * memory (pdir_use_kern), unless the lazy switch is turned off.
+         */
+        if (!get_pdir_lazy()) {
+            set_pdir_base(0);  // switch to the kernel's page table
+        }
         last_active[cpu_idx] = 0;
     }
 
@@ -150,7 +203,9 @@ void trap(tf_t *tf)
     if (last_pid != 0)
     {
         kstack_switch(cur_pid);
-        set_pdir_base(cur_pid);
+        if (get_pdir_base() != cur_pid) {
+            set_pdir_base(cur_pid);
+        }
         last_active[cpu_idx] = last_pid;
     }
 
@@ -4,11 +4,15 @@
 #ifdef _KERN_
 
 unsigned int get_curid(void);
-unsigned int alloc_page(unsigned int proc_index, unsigned int vaddr,
-                        unsigned int perm);
+unsigned int copy_on_write(unsigned int proc_index, unsigned int vaddr);
 unsigned int syscall_get_arg1(void);
 void set_pdir_base(unsigned int index);
+unsigned int get_pdir_base(void);
+unsigned int get_pdir_lazy(void);
+void tlb_shootdown_handle(void);
 void proc_start_user(void);
+void proc_exit(void);
+void sched_update(void);
 
 #endif  /* _KERN_ */
 
@@ -30,14 +30,22 @@ void trap_handler_register(int cpu_idx, int trapno, trap_cb_t cb)
 
 void trap_init(unsigned int cpu_idx)
 {
+    int trapno;
+
     if (cpu_idx == 0) {
         trap_init_array();
     }
 
     KERN_INFO_CPU("Register trap handlers...\n", cpu_idx);
 
-    // TODO: for CPU # [cpu_idx], register appropriate trap handler for each trap number,
-    // with trap_handler_register function defined above.
+    for (trapno = T_DIVIDE; trapno <= T_SECEV; trapno++) {
+        trap_handler_register(cpu_idx, trapno, exception_handler);
+    }
+    for (trapno = T_IRQ0; trapno <= T_IRQ0 + IRQ_IDE2; trapno++) {
+        trap_handler_register(cpu_idx, trapno, interrupt_handler);
+    }
+    trap_handler_register(cpu_idx, T_SYSCALL, syscall_dispatch);
+    trap_handler_register(cpu_idx, T_IPI0 + IPI_INVALC, interrupt_handler);
 
     KERN_INFO_CPU("Done.\n", cpu_idx);
     KERN_INFO_CPU("Enabling interrupts...\n", cpu_idx);
@@ -34,26 +34,24 @@ void pdir_init(unsigned int mbi_addr)
 }
 
 /**
- * Allocates a page (with container_alloc) for the page table,
- * and registers it in the page directory for the given virtual address,
- * and clears (set to 0) all page table entries for this newly mapped page table.
+ * Allocates a zeroed page (with container_alloc_zeroed) for the page table,
+ * and registers it in the page directory for the given virtual address.
+ * All page table entries of the newly mapped page table are already cleared.
  * It returns the page index of the newly allocated physical page.
  * In the case when there's no physical page available, it returns 0.
  */
 unsigned int alloc_ptbl(unsigned int proc_index, unsigned int vaddr)
 {
-    unsigned int page_index = container_alloc(proc_index);
-    unsigned int pde_index = PDE_ADDR(vaddr);
-    unsigned int pte_index;
+    unsigned int page_index;
+
+    // The page may be cleared through the identity map.
+    pdir_use_kern();
+    page_index = container_alloc_zeroed(proc_index);
 
     if (page_index == 0) {
         return 0;
     } else {
         set_pdir_entry_by_va(proc_index, vaddr, page_index);
-        for (pte_index = 0; pte_index < 1024; pte_index++) {
-            rmv_ptbl_entry(proc_index, pde_index, pte_index);
-        }
-
         return page_index;
     }
 }
@@ -65,6 +63,7 @@ void free_ptbl(unsigned int proc_index, unsigned int vaddr)
 {
     unsigned int page_index = get_pdir_entry_by_va(proc_index, vaddr) >> 12;
 
+    pdir_use_kern();
     rmv_pdir_entry(proc_index, PDE_ADDR(vaddr));
     container_free(proc_index, page_index);
 }
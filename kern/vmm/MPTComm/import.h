@@ -3,13 +3,12 @@
 
 #ifdef _KERN_
 
-unsigned int container_alloc(unsigned int id);
+unsigned int container_alloc_zeroed(unsigned int id);
 void container_free(unsigned int id, unsigned int page_index);
 void idptbl_init(unsigned int mbi_addr);
+void pdir_use_kern(void);
 void set_pdir_entry_identity(unsigned int proc_index, unsigned int pde_index);
 void rmv_pdir_entry(unsigned int proc_index, unsigned int pde_index);
-void rmv_ptbl_entry(unsigned int proc_index, unsigned int pde_index,
-                    unsigned int pte_index);
 unsigned int get_pdir_entry_by_va(unsigned int proc_index, unsigned int vaddr);
 void rmv_pdir_entry_by_va(unsigned int proc_index, unsigned int vaddr);
 void set_pdir_entry_by_va(unsigned int proc_index, unsigned int vaddr,
@@ -2,6 +2,7 @@
 #include <lib/x86.h>
 #include <lib/debug.h>
 #include <lib/spinlock.h>
+#include <pcpu/PCPUIntro/export.h>
 
 #include "import.h"
 
@@ -10,6 +11,12 @@
 
 #define ADDR_MASK(x) ((unsigned int) x & 0xfffff000)
 
+#define PDIRSIZE      (PAGESIZE * 1024)
+#define VM_USERLO     0x40000000
+#define VM_USERHI     0xF0000000
+#define VM_USERLO_PDE (VM_USERLO / PDIRSIZE)
+#define VM_USERHI_PDE (VM_USERHI / PDIRSIZE)
+
 static spinlock_t pt_lk;
 
 /**
@@ -29,20 +36,85 @@ static spinlock_t pt_lk;
 unsigned int *PDirPool[NUM_IDS][1024] gcc_aligned(PAGESIZE);
 
 /**
- * In mCertiKOS, we use identity page table mappings for the kernel memory.
- * IDPTbl is an array of statically allocated identity page tables that will be
- * reused for all the kernel memory.
+ * In mCertiKOS, we use identity mappings for the kernel memory.
+ * IDPDir holds one identity page directory entry for each 4MB region, which
+ * maps the whole region with a single 4MB page (PTE_PS), so no identity page
+ * tables are needed and the kernel needs one TLB entry per 4MB.
  * That is, in every page directory, the entries that fall into the range of
- * addresses reserved for the kernel will point to an entry in IDPTbl.
+ * addresses reserved for the kernel are copies of the entries in IDPDir.
+ */
+unsigned int IDPDir[1024] gcc_aligned(PAGESIZE);
+
+// The base address of the 4MB page mapped by a page directory entry with PTE_PS set.
+#define PS_ADDR_MASK(x) ((unsigned int) x & 0xffc00000)
+
+/**
+ * The index of the page structure loaded in the CR3 register of each CPU.
+ * Only the kernel's page structure (0) maps the user part of the physical
+ * memory, i.e., the page tables and the user pages, with the identity map.
  */
-unsigned int IDPTbl[1024][1024] gcc_aligned(PAGESIZE);
+static volatile unsigned int PDirLoaded[NUM_CPUS];
 
-// Sets the CR3 register with the start address of the page structure for process # [index].
+/**
+ * Whether a trap from user mode keeps running on the page structure of the
+ * current process, only loading the kernel's page structure when the physical
+ * memory has to be accessed (see pdir_use_kern).
+ * Otherwise the kernel's page structure is loaded on every trap entry, which
+ * is selected at build time with EAGER_CR3 (see config.mk).
+ */
+#ifdef EAGER_CR3
+static unsigned int pdir_lazy = 0;
+#else
+static unsigned int pdir_lazy = 1;
+#endif
+
+/**
+ * Sets the CR3 register with the start address of the page structure for process # [index].
+ * The index is published before CR3 is loaded, so that a CPU changing the
+ * page structure either sees this CPU in tlb_shootdown, or changed the
+ * entries before this CPU could cache them (set_cr3 is serializing).
+ */
 void set_pdir_base(unsigned int index)
 {
+    PDirLoaded[get_pcpu_idx()] = index;
     set_cr3(PDirPool[index]);
 }
 
+// Returns the index of the page structure loaded on the current CPU.
+unsigned int get_pdir_base(void)
+{
+    return PDirLoaded[get_pcpu_idx()];
+}
+
+// Returns the index of the page structure loaded on CPU # [cpu_idx].
+unsigned int get_pdir_base_cpu(unsigned int cpu_idx)
+{
+    return PDirLoaded[cpu_idx];
+}
+
+/**
+ * Loads the kernel's page structure unless it is already loaded on the
+ * current CPU. It has to be called before the kernel accesses the user part
+ * of the physical memory through the identity map.
+ */
+void pdir_use_kern(void)
+{
+    if (PDirLoaded[get_pcpu_idx()] != 0) {
+        set_pdir_base(0);
+    }
+}
+
+// The getter and setter functions for the lazy page structure switch on traps.
+unsigned int get_pdir_lazy(void)
+{
+    return pdir_lazy;
+}
+
+void set_pdir_lazy(unsigned int lazy)
+{
+    pdir_lazy = (lazy != 0);
+}
+
 // Returns the page directory entry # [pde_index] of the process # [proc_index].
 // This can be used to test whether the page directory entry is mapped.
 unsigned int get_pdir_entry(unsigned int proc_index, unsigned int pde_index)
@@ -61,13 +133,20 @@ void set_pdir_entry(unsigned int proc_index, unsigned int pde_index,
 }
 
 // Sets the page directory entry # [pde_index] for the process # [proc_index]
-// with the initial address of page directory # [pde_index] in IDPTbl.
-// You should also set the permissions PTE_P, PTE_W, and PTE_U.
-// This will be used to map a page directory entry to an identity page table.
+// with the identity entry # [pde_index] in IDPDir.
+// This will be used to map a page directory entry to an identity 4MB page.
 void set_pdir_entry_identity(unsigned int proc_index, unsigned int pde_index)
 {
-    unsigned int addr = (unsigned int) IDPTbl[pde_index];
-    PDirPool[proc_index][pde_index] = (unsigned int *) (addr | PT_PERM_PTU);
+    PDirPool[proc_index][pde_index] = (unsigned int *) IDPDir[pde_index];
+}
+
+// Maps the page directory entry # [pde_index] of the process # [proc_index] to
+// the 4MB page that starts at physical page # [page_index], with the given permission.
+void set_pdir_entry_large(unsigned int proc_index, unsigned int pde_index,
+                          unsigned int page_index, unsigned int perm)
+{
+    KERN_ASSERT(page_index % 1024 == 0);
+    PDirPool[proc_index][pde_index] = (unsigned int *) ((page_index << 12) | perm | PTE_PS);
 }
 
 // Removes the specified page directory entry (sets the page directory entry to 0).
@@ -79,36 +158,225 @@ void rmv_pdir_entry(unsigned int proc_index, unsigned int pde_index)
 
 // Returns the specified page table entry.
 // Do not forget that the permission info is also stored in the page directory entries.
+// For a 4MB page, it returns the entry a page table would hold for the 4KB page
+// within it, with the permission of the page directory entry.
 unsigned int get_ptbl_entry(unsigned int proc_index, unsigned int pde_index,
                             unsigned int pte_index)
 {
-    unsigned int *pt = (unsigned int *) ADDR_MASK(PDirPool[proc_index][pde_index]);
+    unsigned int pde = (unsigned int) PDirPool[proc_index][pde_index];
+    unsigned int *pt;
+
+    if (pde & PTE_PS) {
+        return (PS_ADDR_MASK(pde) | (pte_index << 12)) | (pde & 0xfff & ~PTE_PS);
+    }
+
+    pdir_use_kern();
+    pt = (unsigned int *) ADDR_MASK(pde);
     return pt[pte_index];
 }
 
 // Sets the specified page table entry with the start address of physical page # [page_index]
 // You should also set the given permission.
+// A 4MB page has no page table, so it is left alone.
 void set_ptbl_entry(unsigned int proc_index, unsigned int pde_index,
                     unsigned int pte_index, unsigned int page_index,
                     unsigned int perm)
 {
-    unsigned int *pt = (unsigned int *) ADDR_MASK(PDirPool[proc_index][pde_index]);
+    unsigned int pde = (unsigned int) PDirPool[proc_index][pde_index];
+    unsigned int *pt = (unsigned int *) ADDR_MASK(pde);
+
+    if (pde & PTE_PS) {
+        return;
+    }
+
+    pdir_use_kern();
     pt[pte_index] = (page_index << 12) | perm;
 }
 
-// Sets up the specified page table entry in IDPTbl as the identity map.
-// You should also set the given permission.
-void set_ptbl_entry_identity(unsigned int pde_index, unsigned int pte_index,
-                             unsigned int perm)
+/**
+ * Sets the [n] consecutive page table entries starting at # [pte_index] of the
+ * page table registered in page directory entry # [pde_index] to the physical
+ * pages [pages[0], ..., pages[n - 1]] with the given permission.
+ * The page directory entry is read once, and the entries are filled in
+ * a tight loop. All the entries have to be in the same page table,
+ * i.e., pte_index + n <= 1024. A 4MB page has no page table, so it is left alone.
+ */
+void set_ptbl_entries(unsigned int proc_index, unsigned int pde_index,
+                      unsigned int pte_index, unsigned int *pages,
+                      unsigned int n, unsigned int perm)
+{
+    unsigned int pde = (unsigned int) PDirPool[proc_index][pde_index];
+    unsigned int *pt = (unsigned int *) ADDR_MASK(pde);
+    unsigned int i;
+
+    KERN_ASSERT(pte_index + n <= 1024);
+
+    if (pde & PTE_PS) {
+        return;
+    }
+
+    pdir_use_kern();
+    for (i = 0; i < n; i++) {
+        pt[pte_index + i] = (pages[i] << 12) | perm;
+    }
+}
+
+/**
+ * Clears the [n] consecutive page table entries starting at # [pte_index] of
+ * the page table registered in page directory entry # [pde_index].
+ * If [pages] is not NULL, the physical page indices of the entries that were
+ * present are stored in it. It returns the number of such entries.
+ */
+unsigned int rmv_ptbl_entries(unsigned int proc_index, unsigned int pde_index,
+                              unsigned int pte_index, unsigned int n,
+                              unsigned int *pages)
+{
+    unsigned int pde = (unsigned int) PDirPool[proc_index][pde_index];
+    unsigned int *pt = (unsigned int *) ADDR_MASK(pde);
+    unsigned int i, nr_rmv = 0;
+
+    KERN_ASSERT(pte_index + n <= 1024);
+
+    if (pde & PTE_PS) {
+        return 0;
+    }
+
+    pdir_use_kern();
+    for (i = pte_index; i < pte_index + n; i++) {
+        if (pt[i] & PTE_P) {
+            if (pages != NULL) {
+                pages[nr_rmv] = pt[i] >> 12;
+            }
+            nr_rmv++;
+        }
+        pt[i] = 0;
+    }
+
+    return nr_rmv;
+}
+
+/**
+ * Replaces the permission of the present entries among the [n] consecutive
+ * page table entries starting at # [pte_index] with [perm], keeping their
+ * physical pages and their accessed and dirty bits.
+ * It returns the number of entries that were changed.
+ */
+unsigned int set_ptbl_entries_perm(unsigned int proc_index, unsigned int pde_index,
+                                   unsigned int pte_index, unsigned int n,
+                                   unsigned int perm)
+{
+    unsigned int pde = (unsigned int) PDirPool[proc_index][pde_index];
+    unsigned int *pt = (unsigned int *) ADDR_MASK(pde);
+    unsigned int i, nr_set = 0;
+
+    KERN_ASSERT(pte_index + n <= 1024);
+
+    if (pde & PTE_PS) {
+        return 0;
+    }
+
+    pdir_use_kern();
+    for (i = pte_index; i < pte_index + n; i++) {
+        if ((pt[i] & PTE_P) && (pt[i] & 0xfff & ~(PTE_A | PTE_D)) != perm) {
+            pt[i] = ADDR_MASK(pt[i]) | (pt[i] & (PTE_A | PTE_D)) | perm;
+            nr_set++;
+        }
+    }
+
+    return nr_set;
+}
+
+/**
+ * Samples and clears the accessed and dirty bits of the present entries of the
+ * page table registered in page directory entry # [pde_index] (or of its 4MB
+ * page, which counts as 1024 pages). An entry that was accessed both since the
+ * previous scan and before it, as recorded in its PTE_HOT bit, is hot.
+ * The numbers of accessed, dirty and hot pages are added to [*nr_accessed],
+ * [*nr_dirty] and [*nr_hot]. It returns the number of present pages.
+ * The TLB entries of the page structure have to be flushed afterwards, or the
+ * processor may not set the cleared bits again.
+ */
+unsigned int scan_ptbl_ad(unsigned int proc_index, unsigned int pde_index,
+                          unsigned int *nr_accessed, unsigned int *nr_dirty,
+                          unsigned int *nr_hot)
+{
+    unsigned int pde = (unsigned int) PDirPool[proc_index][pde_index];
+    unsigned int *entry, n, weight, i, nr_present = 0;
+
+    if (pde & PTE_PS) {
+        entry = (unsigned int *) &PDirPool[proc_index][pde_index];
+        n = 1;
+        weight = 1024;
+    } else {
+        pdir_use_kern();
+        entry = (unsigned int *) ADDR_MASK(pde);
+        n = 1024;
+        weight = 1;
+    }
+
+    for (i = 0; i < n; i++) {
+        if ((entry[i] & PTE_P) == 0) {
+            continue;
+        }
+        nr_present += weight;
+        if (entry[i] & PTE_A) {
+            *nr_accessed += weight;
+            if (entry[i] & PTE_HOT) {
+                *nr_hot += weight;
+            }
+        }
+        if (entry[i] & PTE_D) {
+            *nr_dirty += weight;
+        }
+        entry[i] = (entry[i] & ~(PTE_A | PTE_D | PTE_HOT))
+            | ((entry[i] & PTE_A) ? PTE_HOT : 0);
+    }
+
+    return nr_present;
+}
+
+// Sets up the identity entry # [pde_index] in IDPDir as a 4MB page
+// with the given permission.
+void set_pdir_entry_identity_perm(unsigned int pde_index, unsigned int perm)
+{
+    IDPDir[pde_index] = (pde_index << 22) | perm | PTE_PS;
+}
+
+/**
+ * Changes the kernel mapping of page directory entry # [pde_index] to the
+ * identity 4MB page with the given permission. The entry is updated in IDPDir
+ * and in every page directory of PDirPool, so the kernel is mapped the same
+ * way in all the page structures, as global pages require.
+ * Global TLB entries survive CR3 reloads, so the stale one is dropped with
+ * invlpg. Only the TLB of the current CPU is flushed: once the other CPUs
+ * have booted, the entries are changed with protect_kern_large_page
+ * (see MPTKern), which flushes them all.
+ */
+void set_pdir_entry_kern(unsigned int pde_index, unsigned int perm)
 {
-    unsigned int addr = (pde_index << 22) | (pte_index << 12);
-    IDPTbl[pde_index][pte_index] = addr | perm;
+    unsigned int proc_index;
+
+    KERN_ASSERT(pde_index < VM_USERLO_PDE || VM_USERHI_PDE <= pde_index);
+
+    set_pdir_entry_identity_perm(pde_index, perm);
+    for (proc_index = 0; proc_index < NUM_IDS; proc_index++) {
+        set_pdir_entry_identity(proc_index, pde_index);
+    }
+    invlpg(pde_index << 22);
 }
 
 // Sets the specified page table entry to 0.
+// A 4MB page has no page table, so it is left alone.
 void rmv_ptbl_entry(unsigned int proc_index, unsigned int pde_index,
                     unsigned int pte_index)
 {
-    unsigned int *pt = (unsigned int *) ADDR_MASK(PDirPool[proc_index][pde_index]);
+    unsigned int pde = (unsigned int) PDirPool[proc_index][pde_index];
+    unsigned int *pt = (unsigned int *) ADDR_MASK(pde);
+
+    if (pde & PTE_PS) {
+        return;
+    }
+
+    pdir_use_kern();
     pt[pte_index] = 0;
 }
@@ -1,9 +1,11 @@
 #include <lib/x86.h>
 #include <lib/debug.h>
+#include <pcpu/PCPUIntro/export.h>
+#include <pmm/MATOp/export.h>
 #include "export.h"
 
 extern char *PDirPool[NUM_IDS][1024];
-extern unsigned int IDPTbl[1024][1024];
+extern unsigned int IDPDir[1024];
 
 int MPTIntro_test1()
 {
@@ -15,9 +17,9 @@ int MPTIntro_test1()
     }
     set_pdir_entry_identity(1, 1);
     set_pdir_entry(1, 2, 100);
-    if (get_pdir_entry(1, 1) != (unsigned int) IDPTbl[1] + 7) {
+    if (get_pdir_entry(1, 1) != IDPDir[1] || (get_pdir_entry(1, 1) & PTE_PS) == 0) {
         dprintf("test 1.2 failed: (%d != %d)\n",
-                get_pdir_entry(1, 1), (unsigned int) IDPTbl[1] + 7);
+                get_pdir_entry(1, 1), IDPDir[1]);
         return 1;
     }
     if (get_pdir_entry(1, 2) != 409607) {
@@ -31,28 +33,139 @@ int MPTIntro_test1()
                 get_pdir_entry(1, 1), get_pdir_entry(1, 2));
         return 1;
     }
+    // The entries belong to the kernel part of the page directory.
+    set_pdir_entry_identity(1, 1);
+    set_pdir_entry_identity(1, 2);
     dprintf("test 1 passed.\n");
     return 0;
 }
 
 int MPTIntro_test2()
 {
-    set_pdir_entry(1, 1, 10000);
+    // The page table is allocated, as the free pages hold the links of the free lists,
+    // and the kernel entry it replaces is restored at the end.
+    unsigned int ptbl = palloc();
+
+    set_pdir_entry(1, 1, ptbl);
     set_ptbl_entry(1, 1, 1, 10000, 259);
     if (get_ptbl_entry(1, 1, 1) != 40960259) {
         dprintf("test 2.1 failed: (%d != 40960259)\n", get_ptbl_entry(1, 1, 1));
+        set_pdir_entry_identity(1, 1);
+        pfree(ptbl);
         return 1;
     }
     rmv_ptbl_entry(1, 1, 1);
     if (get_ptbl_entry(1, 1, 1) != 0) {
         dprintf("test 2.2 failed: (%d != 0)\n", get_ptbl_entry(1, 1, 1));
+        set_pdir_entry_identity(1, 1);
+        pfree(ptbl);
         return 1;
     }
-    rmv_pdir_entry(1, 1);
+    set_pdir_entry_identity(1, 1);
+    pfree(ptbl);
     dprintf("test 2 passed.\n");
     return 0;
 }
 
+int MPTIntro_test3()
+{
+    unsigned int old_lazy = get_pdir_lazy();
+
+    set_pdir_base(0);
+    pdir_use_kern();
+    if (get_pdir_base() != 0 || (unsigned int) PDirPool[0] != rcr3()
+        || get_pdir_base_cpu(get_pcpu_idx()) != 0) {
+        dprintf("test 3.1 failed: (%d != 0)\n", get_pdir_base());
+        return 1;
+    }
+    set_pdir_lazy(5);
+    if (get_pdir_lazy() != 1) {
+        dprintf("test 3.2 failed: (%d != 1)\n", get_pdir_lazy());
+        set_pdir_lazy(old_lazy);
+        return 1;
+    }
+    set_pdir_lazy(0);
+    if (get_pdir_lazy() != 0) {
+        dprintf("test 3.3 failed: (%d != 0)\n", get_pdir_lazy());
+        set_pdir_lazy(old_lazy);
+        return 1;
+    }
+    set_pdir_lazy(old_lazy);
+    dprintf("test 3 passed.\n");
+    return 0;
+}
+
+int MPTIntro_test4()
+{
+    unsigned int old_pde = IDPDir[16];
+    unsigned int proc_index;
+
+    set_pdir_entry_kern(16, PTE_P | PTE_W);
+    for (proc_index = 0; proc_index < NUM_IDS; proc_index++) {
+        if (get_pdir_entry(proc_index, 16) != ((16 << 22) | PTE_P | PTE_W | PTE_PS)) {
+            dprintf("test 4.1 failed: (%d != %d)\n", get_pdir_entry(proc_index, 16),
+                    (16 << 22) | PTE_P | PTE_W | PTE_PS);
+            set_pdir_entry_kern(16, old_pde & 0xfff & ~PTE_PS);
+            return 1;
+        }
+    }
+    set_pdir_entry_kern(16, old_pde & 0xfff & ~PTE_PS);
+    if (IDPDir[16] != old_pde || get_pdir_entry(NUM_IDS - 1, 16) != old_pde) {
+        dprintf("test 4.2 failed: (%d != %d)\n", IDPDir[16], old_pde);
+        return 1;
+    }
+    dprintf("test 4 passed.\n");
+    return 0;
+}
+
+int MPTIntro_test5()
+{
+    unsigned int i, present, accessed = 0, dirty = 0, hot = 0;
+    unsigned int ptbl = palloc();
+
+    set_pdir_entry(1, 1, ptbl);
+    for (i = 0; i < 1024; i++) {
+        rmv_ptbl_entry(1, 1, i);
+    }
+    set_ptbl_entry(1, 1, 1, 10001, PTE_P | PTE_U | PTE_A | PTE_D);
+    set_ptbl_entry(1, 1, 2, 10002, PTE_P | PTE_U | PTE_A);
+    set_ptbl_entry(1, 1, 3, 10003, PTE_P | PTE_U);
+    present = scan_ptbl_ad(1, 1, &accessed, &dirty, &hot);
+    if (present != 3 || accessed != 2 || dirty != 1 || hot != 0) {
+        dprintf("test 5.1 failed: (%d, %d, %d, %d != 3, 2, 1, 0)\n",
+                present, accessed, dirty, hot);
+        set_pdir_entry_identity(1, 1);
+        pfree(ptbl);
+        return 1;
+    }
+    if (get_ptbl_entry(1, 1, 1) != (10001 << 12 | PTE_P | PTE_U | PTE_HOT)) {
+        dprintf("test 5.2 failed: (%d != %d)\n", get_ptbl_entry(1, 1, 1),
+                10001 << 12 | PTE_P | PTE_U | PTE_HOT);
+        set_pdir_entry_identity(1, 1);
+        pfree(ptbl);
+        return 1;
+    }
+    // Only the pages accessed in both periods are hot.
+    set_ptbl_entry(1, 1, 1, 10001, PTE_P | PTE_U | PTE_HOT | PTE_A);
+    set_ptbl_entry(1, 1, 3, 10003, PTE_P | PTE_U | PTE_A);
+    accessed = dirty = hot = 0;
+    present = scan_ptbl_ad(1, 1, &accessed, &dirty, &hot);
+    if (present != 3 || accessed != 2 || dirty != 0 || hot != 1) {
+        dprintf("test 5.3 failed: (%d, %d, %d, %d != 3, 2, 0, 1)\n",
+                present, accessed, dirty, hot);
+        set_pdir_entry_identity(1, 1);
+        pfree(ptbl);
+        return 1;
+    }
+    for (i = 1; i <= 3; i++) {
+        rmv_ptbl_entry(1, 1, i);
+    }
+    set_pdir_entry_identity(1, 1);
+    pfree(ptbl);
+    dprintf("test 5 passed.\n");
+    return 0;
+}
+
 /**
  * Write Your Own Test Script (optional)
  *
@@ -75,5 +188,6 @@ int MPTIntro_test_own()
 
 int test_MPTIntro()
 {
-    return MPTIntro_test1() + MPTIntro_test2() + MPTIntro_test_own();
+    return MPTIntro_test1() + MPTIntro_test2() + MPTIntro_test3() + MPTIntro_test4() + MPTIntro_test5()
+           + MPTIntro_test_own();
 }
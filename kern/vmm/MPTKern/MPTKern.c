@@ -1,5 +1,9 @@
 #include <lib/x86.h>
 #include <lib/debug.h>
+#include <lib/spinlock.h>
+#include <dev/intr.h>
+#include <dev/lapic.h>
+#include <pcpu/PCPUIntro/export.h>
 
 #include "import.h"
 
@@ -10,16 +14,54 @@
 #define VM_USERLO_PDE (VM_USERLO / PDIRSIZE)
 #define VM_USERHI_PDE (VM_USERHI / PDIRSIZE)
 
+#define PDE_ADDR(x) (x >> 22)
+#define PTE_ADDR(x) ((x >> 12) & 0x3ff)
+
+// Above this number of pages, a range is dropped from the TLB with a CR3 reload.
+#define INVLPG_MAX 32
+
+/**
+ * The invalidations queued for each CPU by the other CPUs, which changed the
+ * page structure the CPU has loaded (see tlb_shootdown). The CPU is sent one
+ * IPI for a whole range, and drops the queued pages from its TLB with invlpg,
+ * or reloads its CR3 if more than INVLPG_MAX pages were queued.
+ * A change of the kernel's mappings, which are global and survive CR3
+ * reloads, is queued for every CPU as TLB_FLUSH_GLOBAL instead (see
+ * tlb_shootdown_kern).
+ * [req] counts the ranges queued, and [ack] the ones already handled.
+ */
+#define TLB_FLUSH_ALL    (INVLPG_MAX + 1)
+#define TLB_FLUSH_GLOBAL (INVLPG_MAX + 2)
+
+struct tlb_queue {
+    spinlock_t lk;
+    unsigned int nr;  /* the number of pages queued, TLB_FLUSH_ALL or TLB_FLUSH_GLOBAL */
+    unsigned int va[INVLPG_MAX];
+    volatile unsigned int req;
+    volatile unsigned int ack;
+};
+
+static struct tlb_queue tlb_queues[NUM_CPUS];
+
+void tlb_flush_range(unsigned int proc_index, unsigned int vaddr,
+                     unsigned int npages);
+
 /**
  * Sets the entire page map for process 0 as the identity map.
  * Note that part of the task is already completed by pdir_init.
  */
 void pdir_init_kern(unsigned int mbi_addr)
 {
-    unsigned int pde_index;
+    unsigned int pde_index, cpu_idx;
 
     pdir_init(mbi_addr);
 
+    for (cpu_idx = 0; cpu_idx < NUM_CPUS; cpu_idx++) {
+        spinlock_init(&tlb_queues[cpu_idx].lk);
+        tlb_queues[cpu_idx].nr = 0;
+        tlb_queues[cpu_idx].req = tlb_queues[cpu_idx].ack = 0;
+    }
+
     // Set identity map for user PDEs
     for (pde_index = VM_USERLO_PDE; pde_index < VM_USERHI_PDE; pde_index++) {
         set_pdir_entry_identity(0, pde_index);
@@ -64,6 +106,390 @@ unsigned int unmap_page(unsigned int proc_index, unsigned int vaddr)
     unsigned int pte_entry = get_ptbl_entry_by_va(proc_index, vaddr);
     if (pte_entry != 0) {
         rmv_ptbl_entry_by_va(proc_index, vaddr);
+        tlb_flush_range(proc_index, vaddr, 1);
     }
     return pte_entry;
 }
+
+/**
+ * Handles the invalidations queued for the current CPU: called on the
+ * IPI_INVALC interrupt, and by a CPU that waits for other CPUs in
+ * tlb_shootdown, as interrupts are disabled in the kernel.
+ */
+void tlb_shootdown_handle(void)
+{
+    struct tlb_queue *q = &tlb_queues[get_pcpu_idx()];
+    unsigned int i;
+
+    spinlock_acquire(&q->lk);
+    if (q->nr == TLB_FLUSH_GLOBAL) {
+        tlb_flush_global();
+    } else if (q->nr == TLB_FLUSH_ALL) {
+        set_pdir_base(get_pdir_base());
+    } else {
+        for (i = 0; i < q->nr; i++) {
+            invlpg(q->va[i]);
+        }
+    }
+    q->nr = 0;
+    q->ack = q->req;
+    spinlock_release(&q->lk);
+}
+
+/**
+ * Queues the npages pages starting at [vaddr] for CPU # [cpu_idx], or a flush
+ * of its whole TLB, global entries included, if [global] is set, and sends it
+ * an IPI. A queue that already flushes the whole TLB is left as it is.
+ * It returns the value of [req] to wait for (see tlb_shootdown_wait).
+ */
+static unsigned int tlb_shootdown_queue(unsigned int cpu_idx, unsigned int vaddr,
+                                        unsigned int npages, unsigned int global)
+{
+    struct tlb_queue *q = &tlb_queues[cpu_idx];
+    unsigned int req, i;
+
+    spinlock_acquire(&q->lk);
+    if (global) {
+        q->nr = TLB_FLUSH_GLOBAL;
+    } else if (q->nr >= TLB_FLUSH_ALL) {
+        // The queued flush drops the range too.
+    } else if (q->nr + npages > INVLPG_MAX) {
+        q->nr = TLB_FLUSH_ALL;
+    } else {
+        for (i = 0; i < npages; i++) {
+            q->va[q->nr++] = vaddr + i * PAGESIZE;
+        }
+    }
+    req = ++q->req;
+    spinlock_release(&q->lk);
+
+    lapic_send_ipi(pcpu_cpu_lapicid(cpu_idx), T_IPI0 + IPI_INVALC,
+                   LAPIC_ICRLO_FIXED, LAPIC_ICRLO_NOBCAST);
+    return req;
+}
+
+/**
+ * Waits until every CPU # i with a non-zero [wait[i]] has handled its queue
+ * up to it. As interrupts are disabled in the kernel, the CPU handles its own
+ * queue while it waits, since two CPUs may be shooting down each other's TLBs.
+ * The caller must thus not hold any spinlock: a CPU it waits for could be
+ * spinning on that lock, and would never handle its queue.
+ */
+static void tlb_shootdown_wait(unsigned int *wait)
+{
+    unsigned int cpu_idx;
+
+    for (cpu_idx = 0; cpu_idx < NUM_CPUS; cpu_idx++) {
+        if (wait[cpu_idx] == 0) {
+            continue;
+        }
+        while ((int) (tlb_queues[cpu_idx].ack - wait[cpu_idx]) < 0) {
+            tlb_shootdown_handle();
+            pause();
+        }
+    }
+}
+
+/**
+ * Drops the translations of the npages pages starting at [vaddr] of process
+ * # [proc_index] from the TLBs of the other CPUs that have its page structure
+ * loaded. The range is queued for each of them, each is sent a single IPI for
+ * it, and the function returns once all of them have handled their queues,
+ * so that the pages can be freed.
+ * The kernel's page structure (0) is only changed at boot, and is left alone.
+ * The pages are mapped and unmapped (see map_page, unmap_page and the
+ * functions below) with no spinlock held (see tlb_shootdown_wait), as in
+ * vmr_fault, which drops vmr_shared_lk before map_page.
+ */
+static void tlb_shootdown(unsigned int proc_index, unsigned int vaddr,
+                          unsigned int npages)
+{
+    unsigned int wait[NUM_CPUS];
+    unsigned int self = get_pcpu_idx();
+    unsigned int cpu_idx;
+
+    if (proc_index == 0) {
+        return;
+    }
+
+    // The changed entries have to be visible before the loaded page
+    // structures are read.
+    FENCE();
+
+    for (cpu_idx = 0; cpu_idx < NUM_CPUS; cpu_idx++) {
+        wait[cpu_idx] = 0;
+        if (cpu_idx != self && get_pdir_base_cpu(cpu_idx) == proc_index) {
+            wait[cpu_idx] = tlb_shootdown_queue(cpu_idx, vaddr, npages, FALSE);
+        }
+    }
+
+    tlb_shootdown_wait(wait);
+}
+
+/**
+ * Drops the whole TLB, global entries included, of every other CPU that has
+ * booted, whatever page structure it has loaded, after a change of the
+ * kernel's mappings, and returns once all of them have. A booted CPU handles
+ * its queue on the IPI while it runs a process, and in the idle loop.
+ */
+static void tlb_shootdown_kern(void)
+{
+    unsigned int wait[NUM_CPUS];
+    unsigned int self = get_pcpu_idx();
+    unsigned int cpu_idx;
+
+    FENCE();
+
+    for (cpu_idx = 0; cpu_idx < NUM_CPUS; cpu_idx++) {
+        wait[cpu_idx] = 0;
+        if (cpu_idx != self && get_pcpu_boot_info(cpu_idx)) {
+            wait[cpu_idx] = tlb_shootdown_queue(cpu_idx, 0, 0, TRUE);
+        }
+    }
+
+    tlb_shootdown_wait(wait);
+}
+
+/**
+ * Drops the translations of the npages pages starting at [vaddr] from the TLB,
+ * once for the whole range. Nothing is needed when another page structure is
+ * loaded on this CPU, as the process's entries are not global and reloading
+ * its page structure flushes them. The other CPUs that have the page structure
+ * loaded are shot down (see tlb_shootdown). It is called by the functions
+ * below, and by the layers above that change the page table entries of a
+ * process directly (see pdir_copy_cow and copy_on_write).
+ */
+void tlb_flush_range(unsigned int proc_index, unsigned int vaddr,
+                     unsigned int npages)
+{
+    unsigned int i;
+
+    tlb_shootdown(proc_index, vaddr, npages);
+
+    if (get_pdir_base() != proc_index) {
+        return;
+    }
+
+    if (npages <= INVLPG_MAX) {
+        for (i = 0; i < npages; i++) {
+            invlpg(vaddr + i * PAGESIZE);
+        }
+    } else {
+        set_pdir_base(proc_index);
+    }
+}
+
+/**
+ * Maps the npages consecutive pages starting at the page aligned virtual
+ * address [vaddr] to the physical pages [pages[0], ..., pages[npages - 1]]
+ * with the given permission.
+ * The page directory is walked once per 4MB slot, allocating the page table
+ * if needed, and the page table entries of the slot are filled in one go.
+ * It returns npages, or MagicNumber if a page table cannot be allocated,
+ * in which case the pages before that slot stay mapped.
+ */
+unsigned int map_range(unsigned int proc_index, unsigned int vaddr,
+                       unsigned int *pages, unsigned int npages,
+                       unsigned int perm)
+{
+    unsigned int va = vaddr, done = 0, n;
+
+    while (done < npages) {
+        n = 1024 - PTE_ADDR(va);
+        if (n > npages - done) {
+            n = npages - done;
+        }
+
+        if (get_pdir_entry_by_va(proc_index, va) == 0
+            && alloc_ptbl(proc_index, va) == 0) {
+            tlb_flush_range(proc_index, vaddr, done);
+            return MagicNumber;
+        }
+        set_ptbl_entries(proc_index, PDE_ADDR(va), PTE_ADDR(va),
+                         pages + done, n, perm);
+
+        va += n * PAGESIZE;
+        done += n;
+    }
+
+    tlb_flush_range(proc_index, vaddr, npages);
+    return npages;
+}
+
+/**
+ * Removes the mappings of the npages consecutive pages starting at the page
+ * aligned virtual address [vaddr]. Slots without a page table are skipped.
+ * If [pages] is not NULL, the physical page indices of the removed mappings
+ * are stored in it, so that the caller can free them in a batch.
+ * It returns the number of removed mappings.
+ */
+unsigned int unmap_range(unsigned int proc_index, unsigned int vaddr,
+                         unsigned int npages, unsigned int *pages)
+{
+    unsigned int va = vaddr, done = 0, nr_rmv = 0, n;
+
+    while (done < npages) {
+        n = 1024 - PTE_ADDR(va);
+        if (n > npages - done) {
+            n = npages - done;
+        }
+
+        if (get_pdir_entry_by_va(proc_index, va) != 0) {
+            nr_rmv += rmv_ptbl_entries(proc_index, PDE_ADDR(va), PTE_ADDR(va), n,
+                                       pages == NULL ? NULL : pages + nr_rmv);
+        }
+
+        va += n * PAGESIZE;
+        done += n;
+    }
+
+    tlb_flush_range(proc_index, vaddr, npages);
+    return nr_rmv;
+}
+
+/**
+ * Changes the permission of the mapped pages among the npages consecutive
+ * pages starting at the page aligned virtual address [vaddr] to [perm].
+ * It returns the number of changed mappings.
+ */
+unsigned int protect_range(unsigned int proc_index, unsigned int vaddr,
+                           unsigned int npages, unsigned int perm)
+{
+    unsigned int va = vaddr, done = 0, nr_set = 0, n;
+
+    while (done < npages) {
+        n = 1024 - PTE_ADDR(va);
+        if (n > npages - done) {
+            n = npages - done;
+        }
+
+        if (get_pdir_entry_by_va(proc_index, va) != 0) {
+            nr_set += set_ptbl_entries_perm(proc_index, PDE_ADDR(va),
+                                            PTE_ADDR(va), n, perm);
+        }
+
+        va += n * PAGESIZE;
+        done += n;
+    }
+
+    if (nr_set != 0) {
+        tlb_flush_range(proc_index, vaddr, npages);
+    }
+    return nr_set;
+}
+
+/**
+ * Maps the 4MB aligned virtual address [vaddr] to the 4MB page that starts at
+ * the physical page # [page_index] (1024 contiguous pages, aligned to 1024)
+ * with the given permission, with a single page directory entry and no page
+ * table.
+ * It returns page_index, or MagicNumber if the 4MB slot of [vaddr] already has
+ * a page table or a 4MB page.
+ */
+unsigned int map_large_page(unsigned int proc_index, unsigned int vaddr,
+                            unsigned int page_index, unsigned int perm)
+{
+    KERN_ASSERT(vaddr % PDIRSIZE == 0);
+
+    if (get_pdir_entry_by_va(proc_index, vaddr) != 0) {
+        return MagicNumber;
+    }
+
+    set_pdir_entry_large(proc_index, PDE_ADDR(vaddr), page_index, perm);
+    return page_index;
+}
+
+/**
+ * Removes the 4MB page mapped at [vaddr], if any.
+ * It returns the first physical page index of the 4MB page, or 0 if the slot
+ * of [vaddr] is not mapped with a 4MB page.
+ */
+unsigned int unmap_large_page(unsigned int proc_index, unsigned int vaddr)
+{
+    unsigned int pde = get_pdir_entry_by_va(proc_index, vaddr);
+
+    if ((pde & PTE_PS) == 0) {
+        return 0;
+    }
+
+    rmv_pdir_entry(proc_index, PDE_ADDR(vaddr));
+    // A single invlpg drops the whole 4MB translation.
+    tlb_flush_range(proc_index, vaddr & ~(PDIRSIZE - 1), 1);
+    return pde >> 12;
+}
+
+/**
+ * Replaces the 4MB page mapped at [vaddr], if any, with a page table mapping
+ * the same 1024 physical pages with the same permission, so that parts of it
+ * can be unmapped or shared on their own.
+ * It returns 0, or MagicNumber if the page table cannot be allocated, in which
+ * case the 4MB page stays mapped.
+ */
+unsigned int split_large_page(unsigned int proc_index, unsigned int vaddr)
+{
+    unsigned int pages[64];
+    unsigned int pde, perm, i, j;
+
+    vaddr &= ~(PDIRSIZE - 1);
+    pde = get_pdir_entry_by_va(proc_index, vaddr);
+    if ((pde & PTE_PS) == 0) {
+        return 0;
+    }
+
+    rmv_pdir_entry(proc_index, PDE_ADDR(vaddr));
+    if (alloc_ptbl(proc_index, vaddr) == 0) {
+        set_pdir_entry_large(proc_index, PDE_ADDR(vaddr), pde >> 12,
+                             pde & 0xfff & ~PTE_PS);
+        return MagicNumber;
+    }
+
+    perm = pde & 0xfff & ~(PTE_PS | PTE_A | PTE_D);
+    for (i = 0; i < 1024; i += 64) {
+        for (j = 0; j < 64; j++) {
+            pages[j] = (pde >> 12) + i + j;
+        }
+        set_ptbl_entries(proc_index, PDE_ADDR(vaddr), i, pages, 64, perm);
+    }
+
+    tlb_flush_range(proc_index, vaddr, 1);
+    return 0;
+}
+
+/**
+ * Changes the permission of the kernel's 4MB identity page at [vaddr] to
+ * [perm] in all the page structures (see set_pdir_entry_kern). The kernel's
+ * entries are global, so every CPU may cache them whatever page structure it
+ * has loaded, and they survive CR3 reloads: all the other CPUs drop their
+ * whole TLB (see tlb_shootdown_kern) before the function returns.
+ */
+void protect_kern_large_page(unsigned int vaddr, unsigned int perm)
+{
+    set_pdir_entry_kern(PDE_ADDR(vaddr), perm);
+    tlb_shootdown_kern();
+}
+
+/**
+ * Samples and clears the accessed and dirty bits of all the user pages of
+ * process # [proc_index] (see scan_ptbl_ad), walking its page directory once,
+ * and then flushes its TLB entries in one go, so that the processor sets the
+ * bits again on the next access.
+ * The numbers of accessed, dirty and hot pages are stored in [*nr_accessed],
+ * [*nr_dirty] and [*nr_hot]. It returns the number of present pages.
+ */
+unsigned int pdir_scan_ad(unsigned int proc_index, unsigned int *nr_accessed,
+                          unsigned int *nr_dirty, unsigned int *nr_hot)
+{
+    unsigned int pde_index, nr_present = 0;
+
+    *nr_accessed = *nr_dirty = *nr_hot = 0;
+
+    for (pde_index = VM_USERLO_PDE; pde_index < VM_USERHI_PDE; pde_index++) {
+        if (get_pdir_entry(proc_index, pde_index) != 0) {
+            nr_present += scan_ptbl_ad(proc_index, pde_index, nr_accessed,
+                                       nr_dirty, nr_hot);
+        }
+    }
+
+    tlb_flush_range(proc_index, VM_USERLO, (VM_USERHI - VM_USERLO) / PAGESIZE);
+    return nr_present;
+}
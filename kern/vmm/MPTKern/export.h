@@ -7,6 +7,23 @@ void pdir_init_kern(unsigned int mbi_addr);
 unsigned int map_page(unsigned int proc_index, unsigned int vaddr,
                       unsigned int page_index, unsigned int perm);
 unsigned int unmap_page(unsigned int proc_index, unsigned int vaddr);
+unsigned int map_range(unsigned int proc_index, unsigned int vaddr,
+                       unsigned int *pages, unsigned int npages,
+                       unsigned int perm);
+unsigned int unmap_range(unsigned int proc_index, unsigned int vaddr,
+                         unsigned int npages, unsigned int *pages);
+unsigned int map_large_page(unsigned int proc_index, unsigned int vaddr,
+                            unsigned int page_index, unsigned int perm);
+unsigned int unmap_large_page(unsigned int proc_index, unsigned int vaddr);
+unsigned int split_large_page(unsigned int proc_index, unsigned int vaddr);
+void tlb_shootdown_handle(void);
+void tlb_flush_range(unsigned int proc_index, unsigned int vaddr,
+                     unsigned int npages);
+unsigned int pdir_scan_ad(unsigned int proc_index, unsigned int *nr_accessed,
+                          unsigned int *nr_dirty, unsigned int *nr_hot);
+unsigned int protect_range(unsigned int proc_index, unsigned int vaddr,
+                           unsigned int npages, unsigned int perm);
+void protect_kern_large_page(unsigned int vaddr, unsigned int perm);
 
 #endif  /* _KERN_ */
 
@@ -5,12 +5,33 @@
 
 void pdir_init(unsigned int mbi_addr);
 void set_pdir_entry_identity(unsigned int proc_index, unsigned int pde_index);
+unsigned int get_pdir_entry(unsigned int proc_index, unsigned int pde_index);
+void set_pdir_entry_large(unsigned int proc_index, unsigned int pde_index,
+                          unsigned int page_index, unsigned int perm);
+void rmv_pdir_entry(unsigned int proc_index, unsigned int pde_index);
 unsigned int get_pdir_entry_by_va(unsigned int proc_index, unsigned int vaddr);
 unsigned int alloc_ptbl(unsigned int proc_index, unsigned int vaddr);
 void set_ptbl_entry_by_va(unsigned int proc_index, unsigned int vaddr,
                           unsigned int page_index, unsigned int perm);
 void rmv_ptbl_entry_by_va(unsigned int proc_index, unsigned int vaddr);
 unsigned int get_ptbl_entry_by_va(unsigned int proc_index, unsigned int vaddr);
+void set_pdir_base(unsigned int index);
+unsigned int get_pdir_base(void);
+unsigned int get_pdir_base_cpu(unsigned int cpu_idx);
+lapicid_t pcpu_cpu_lapicid(int cpu_idx);
+void set_ptbl_entries(unsigned int proc_index, unsigned int pde_index,
+                      unsigned int pte_index, unsigned int *pages,
+                      unsigned int n, unsigned int perm);
+unsigned int rmv_ptbl_entries(unsigned int proc_index, unsigned int pde_index,
+                              unsigned int pte_index, unsigned int n,
+                              unsigned int *pages);
+unsigned int scan_ptbl_ad(unsigned int proc_index, unsigned int pde_index,
+                          unsigned int *nr_accessed, unsigned int *nr_dirty,
+                          unsigned int *nr_hot);
+void set_pdir_entry_kern(unsigned int pde_index, unsigned int perm);
+unsigned int set_ptbl_entries_perm(unsigned int proc_index, unsigned int pde_index,
+                                   unsigned int pte_index, unsigned int n,
+                                   unsigned int perm);
 
 #endif  /* _KERN_ */
 
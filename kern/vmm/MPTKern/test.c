@@ -1,8 +1,13 @@
 #include <lib/debug.h>
+#include <lib/x86.h>
+#include <pcpu/PCPUIntro/export.h>
 #include <pmm/MContainer/export.h>
+#include <vmm/MPTIntro/export.h>
 #include <vmm/MPTOp/export.h>
 #include "export.h"
 
+extern uint32_t pcpu_ncpu(void);
+
 int MPTKern_test1()
 {
     unsigned int vaddr = 4096 * 1024 * 300;
@@ -36,8 +41,10 @@ int MPTKern_test1()
 int MPTKern_test2()
 {
     unsigned int i;
+    // The identity 4MB pages of the user memory are accessed through the
+    // kernel's page structure, which sets their accessed and dirty bits.
     for (i = 256; i < 960; i++) {
-        if (get_ptbl_entry_by_va(0, i * 4096 * 1024L) !=
+        if ((get_ptbl_entry_by_va(0, i * 4096 * 1024L) & ~(PTE_A | PTE_D)) !=
             i * 4096 * 1024L + 3) {
             dprintf("test 2.1 failed (i = %d): (%d != %d)\n",
                     get_ptbl_entry_by_va(0, i * 4096 * 1024L),
@@ -49,6 +56,249 @@ int MPTKern_test2()
     return 0;
 }
 
+int MPTKern_test3()
+{
+    // Eight pages across the boundary of two 4MB slots.
+    unsigned int vaddr = 4096 * 1024 * 302 - 4096 * 4;
+    unsigned int pages[8], rmv[8];
+    unsigned int i;
+
+    for (i = 0; i < 8; i++) {
+        pages[i] = 200 + i;
+    }
+    if (map_range(1, vaddr, pages, 8, PTE_P | PTE_W | PTE_U) != 8) {
+        dprintf("test 3.1 failed: map_range\n");
+        return 1;
+    }
+    for (i = 0; i < 8; i++) {
+        if (get_ptbl_entry_by_va(1, vaddr + 4096 * i)
+            != ((200 + i) << 12 | PTE_P | PTE_W | PTE_U)) {
+            dprintf("test 3.2 failed (i = %d): (%d != %d)\n", i,
+                    get_ptbl_entry_by_va(1, vaddr + 4096 * i),
+                    (200 + i) << 12 | PTE_P | PTE_W | PTE_U);
+            return 1;
+        }
+    }
+    if (protect_range(1, vaddr + 4096 * 2, 4, PTE_P | PTE_U) != 4
+        || get_ptbl_entry_by_va(1, vaddr + 4096 * 5) != (205 << 12 | PTE_P | PTE_U)
+        || get_ptbl_entry_by_va(1, vaddr + 4096 * 6) != (206 << 12 | PTE_P | PTE_W | PTE_U)) {
+        dprintf("test 3.3 failed: (%d != %d)\n", get_ptbl_entry_by_va(1, vaddr + 4096 * 5),
+                205 << 12 | PTE_P | PTE_U);
+        return 1;
+    }
+    unmap_page(1, vaddr + 4096 * 3);
+    if (unmap_range(1, vaddr, 8, rmv) != 7 || rmv[3] != 204 || rmv[6] != 207) {
+        dprintf("test 3.4 failed: (%d != 7)\n", unmap_range(1, vaddr, 8, NULL));
+        return 1;
+    }
+    for (i = 0; i < 8; i++) {
+        if (get_ptbl_entry_by_va(1, vaddr + 4096 * i) != 0) {
+            dprintf("test 3.5 failed (i = %d): (%d != 0)\n", i,
+                    get_ptbl_entry_by_va(1, vaddr + 4096 * i));
+            return 1;
+        }
+    }
+    dprintf("test 3 passed.\n");
+    return 0;
+}
+
+int MPTKern_test4()
+{
+    // A 4MB page made of the physical pages [1024 * 300, 1024 * 301).
+    unsigned int vaddr = 4096 * 1024 * 303;
+    unsigned int page = 1024 * 300;
+    unsigned int perm = PTE_P | PTE_W | PTE_U;
+
+    if (map_large_page(1, vaddr, page, perm) != page
+        || map_large_page(1, vaddr, page, perm) != MagicNumber) {
+        dprintf("test 4.1 failed: map_large_page\n");
+        return 1;
+    }
+    if (get_ptbl_entry_by_va(1, vaddr + 4096 * 5) != ((page + 5) << 12 | perm)) {
+        dprintf("test 4.2 failed: (%d != %d)\n", get_ptbl_entry_by_va(1, vaddr + 4096 * 5),
+                (page + 5) << 12 | perm);
+        return 1;
+    }
+    if (split_large_page(1, vaddr + 4096 * 7) != 0
+        || (get_pdir_entry_by_va(1, vaddr) & PTE_PS) != 0
+        || get_ptbl_entry_by_va(1, vaddr + 4096 * 1023) != ((page + 1023) << 12 | perm)) {
+        dprintf("test 4.3 failed: (%d != %d)\n", get_ptbl_entry_by_va(1, vaddr + 4096 * 1023),
+                (page + 1023) << 12 | perm);
+        return 1;
+    }
+    if (unmap_large_page(1, vaddr) != 0 || unmap_range(1, vaddr, 1024, NULL) != 1024) {
+        dprintf("test 4.4 failed: unmap after split_large_page\n");
+        return 1;
+    }
+    map_large_page(1, vaddr + 4096 * 1024, page, perm);
+    if (unmap_large_page(1, vaddr + 4096 * 1024) != page
+        || get_pdir_entry_by_va(1, vaddr + 4096 * 1024) != 0) {
+        dprintf("test 4.5 failed: (%d != 0)\n", get_pdir_entry_by_va(1, vaddr + 4096 * 1024));
+        return 1;
+    }
+    dprintf("test 4 passed.\n");
+    return 0;
+}
+
+/**
+ * The TLB shootdown test: every application processor loads the page
+ * structure of process 1 and reads a page of it, which the bootstrap
+ * processor then maps to another physical page and unmaps. Both changes
+ * return only once every AP has acknowledged them, and an AP must read the
+ * new page after the first one, not a stale translation of the old one.
+ * The APs then stay until test 6 has changed a kernel mapping, which all of
+ * them must acknowledge too.
+ * Interrupts are disabled in the kernel, so the APs handle their queues
+ * while they wait, as a CPU waiting in tlb_shootdown does.
+ */
+#define SHOOT_VA (4096 * 1024 * 304)
+
+static volatile unsigned int shoot_stage;
+static volatile unsigned int shoot_joined;
+static volatile unsigned int shoot_count[4];  // the APs done with each stage
+static volatile unsigned int shoot_seen[NUM_CPUS][2];
+
+static void shoot_add(volatile unsigned int *counter, int n)
+{
+    unsigned int old;
+    do {
+        old = *counter;
+    } while (cmpxchg(counter, old, old + n) != old);
+}
+
+static void shoot_wait(volatile unsigned int *counter, unsigned int n)
+{
+    while (*counter < n) {
+        pause();
+    }
+}
+
+// Runs the TLB shootdown tests on an application processor.
+void test_MPTKern_ap(void)
+{
+    unsigned int cpu_idx = get_pcpu_idx();
+
+    shoot_add(&shoot_joined, 1);
+    while (shoot_stage < 1) {
+        tlb_shootdown_handle();
+        pause();
+    }
+    // The page is only read in the stage that maps it, in case test 5 failed.
+    if (shoot_stage == 1) {
+        set_pdir_base(1);
+        shoot_seen[cpu_idx][0] = *(volatile unsigned int *) SHOOT_VA;
+        shoot_add(&shoot_count[1], 1);
+    }
+
+    while (shoot_stage < 2) {
+        tlb_shootdown_handle();
+        pause();
+    }
+    if (shoot_stage == 2) {
+        shoot_seen[cpu_idx][1] = *(volatile unsigned int *) SHOOT_VA;
+        shoot_add(&shoot_count[2], 1);
+    }
+
+    while (shoot_stage < 3) {
+        tlb_shootdown_handle();
+        pause();
+    }
+    set_pdir_base(0);
+    shoot_add(&shoot_count[3], 1);
+
+    while (shoot_stage < 4) {
+        tlb_shootdown_handle();
+        pause();
+    }
+}
+
+int MPTKern_test5()
+{
+    unsigned int ncpu = pcpu_ncpu();
+    unsigned int perm = PTE_P | PTE_W | PTE_U;
+    unsigned int old_page, new_page, cpu_idx;
+
+    old_page = container_alloc(1);
+    new_page = container_alloc(1);
+    if (old_page == 0 || new_page == 0) {
+        dprintf("test 5.1 failed: container_alloc\n");
+        return 1;
+    }
+    *(unsigned int *) (old_page * 4096) = 0xAAAA;
+    *(unsigned int *) (new_page * 4096) = 0xBBBB;
+    map_page(1, SHOOT_VA, old_page, perm);
+
+    shoot_wait(&shoot_joined, ncpu - 1);
+    shoot_stage = 1;
+    shoot_wait(&shoot_count[1], ncpu - 1);
+    for (cpu_idx = 1; cpu_idx < ncpu; cpu_idx++) {
+        if (get_pdir_base_cpu(cpu_idx) != 1 || shoot_seen[cpu_idx][0] != 0xAAAA) {
+            dprintf("test 5.2 failed (cpu = %d): (%d != 1 || %x != aaaa)\n", cpu_idx,
+                    get_pdir_base_cpu(cpu_idx), shoot_seen[cpu_idx][0]);
+            return 1;
+        }
+    }
+
+    // Returns once every AP has dropped the translation of the old page.
+    if (map_range(1, SHOOT_VA, &new_page, 1, perm) != 1) {
+        dprintf("test 5.3 failed: map_range\n");
+        return 1;
+    }
+    shoot_stage = 2;
+    shoot_wait(&shoot_count[2], ncpu - 1);
+    for (cpu_idx = 1; cpu_idx < ncpu; cpu_idx++) {
+        if (shoot_seen[cpu_idx][1] != 0xBBBB) {
+            dprintf("test 5.4 failed (cpu = %d): (%x != bbbb)\n", cpu_idx,
+                    shoot_seen[cpu_idx][1]);
+            return 1;
+        }
+    }
+
+    if (unmap_range(1, SHOOT_VA, 1, NULL) != 1) {
+        dprintf("test 5.5 failed: unmap_range\n");
+        return 1;
+    }
+    shoot_stage = 3;
+    shoot_wait(&shoot_count[3], ncpu - 1);
+    for (cpu_idx = 1; cpu_idx < ncpu; cpu_idx++) {
+        if (get_pdir_base_cpu(cpu_idx) != 0) {
+            dprintf("test 5.6 failed (cpu = %d): (%d != 0)\n", cpu_idx,
+                    get_pdir_base_cpu(cpu_idx));
+            return 1;
+        }
+    }
+
+    container_free(1, old_page);
+    container_free(1, new_page);
+    dprintf("test 5 passed (%d CPUs).\n", ncpu);
+    return 0;
+}
+
+int MPTKern_test6()
+{
+    unsigned int old_pde = get_pdir_entry(0, 16);
+    unsigned int vaddr = 16 << 22;
+
+    // Returns once every AP has dropped its global entries.
+    protect_kern_large_page(vaddr, PTE_P | PTE_W);
+    if (get_pdir_entry(0, 16) != (vaddr | PTE_P | PTE_W | PTE_PS)
+        || get_pdir_entry(NUM_IDS - 1, 16) != (vaddr | PTE_P | PTE_W | PTE_PS)) {
+        dprintf("test 6.1 failed: (%d != %d)\n", get_pdir_entry(NUM_IDS - 1, 16),
+                vaddr | PTE_P | PTE_W | PTE_PS);
+        protect_kern_large_page(vaddr, old_pde & 0xfff & ~PTE_PS);
+        shoot_stage = 4;
+        return 1;
+    }
+    protect_kern_large_page(vaddr, old_pde & 0xfff & ~PTE_PS);
+    shoot_stage = 4;
+    if (get_pdir_entry(0, 16) != old_pde || get_pdir_entry(NUM_IDS - 1, 16) != old_pde) {
+        dprintf("test 6.2 failed: (%d != %d)\n", get_pdir_entry(NUM_IDS - 1, 16), old_pde);
+        return 1;
+    }
+    dprintf("test 6 passed.\n");
+    return 0;
+}
+
 /**
  * Write Your Own Test Script (optional)
  *
@@ -71,5 +321,6 @@ int MPTKern_test_own()
 
 int test_MPTKern()
 {
-    return MPTKern_test1() + MPTKern_test2() + MPTKern_test_own();
+    return MPTKern_test1() + MPTKern_test2() + MPTKern_test3() + MPTKern_test4()
+        + MPTKern_test5() + MPTKern_test6() + MPTKern_test_own();
 }
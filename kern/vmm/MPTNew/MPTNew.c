@@ -1,14 +1,27 @@
+#include <lib/string.h>
 #include <lib/x86.h>
 
 #include "import.h"
 
+#define PAGESIZE      4096
+#define PDIRSIZE      (PAGESIZE * 1024)
+#define VM_USERLO     0x40000000
+#define VM_USERHI     0xF0000000
+#define VM_USERLO_PDE (VM_USERLO / PDIRSIZE)
+#define VM_USERHI_PDE (VM_USERHI / PDIRSIZE)
+
+// The number of pages alloc_pages takes from the container at once.
+#define ALLOC_BATCH 64
+// The number of pages pdir_free gives back to the container at once.
+#define FREE_BATCH  64
+
 /**
  * This function will be called when there's no mapping found in the page structure
  * for the given virtual address [vaddr], e.g., by the page fault handler when
  * a page fault happened because the user process accessed a virtual address
  * that is not mapped yet.
- * The task of this function is to allocate a physical page and use it to register
- * a mapping for the virtual address with the given permission.
+ * The task of this function is to allocate a zeroed physical page and use it to
+ * register a mapping for the virtual address with the given permission.
  * It should return the physical page index registered in the page directory, the
  * return value from map_page.
  * In the case of error, it should return the constant MagicNumber.
@@ -16,7 +29,11 @@
 unsigned int alloc_page(unsigned int proc_index, unsigned int vaddr,
                         unsigned int perm)
 {
-    unsigned int page_index = container_alloc(proc_index);
+    unsigned int page_index;
+
+    // The page may be cleared through the identity map.
+    pdir_use_kern();
+    page_index = container_alloc_zeroed(proc_index);
     if (page_index != 0) {
         return map_page(proc_index, vaddr, page_index, perm);
     } else {
@@ -24,6 +41,203 @@ unsigned int alloc_page(unsigned int proc_index, unsigned int vaddr,
     }
 }
 
+/**
+ * Allocates zeroed physical pages for the npages consecutive pages starting
+ * at the page aligned virtual address [vaddr] that are not mapped yet, and maps
+ * them with the given permission. Pages that are already mapped are left alone.
+ * The physical pages are taken from the container ALLOC_BATCH at a time
+ * (with container_alloc_zeroed_batch, which uses the pre-zeroed pages first),
+ * instead of one call per page, and each run of consecutive unmapped pages is
+ * mapped with a single map_range.
+ * It returns the number of newly mapped pages, or MagicNumber in the case of error.
+ */
+unsigned int alloc_pages(unsigned int proc_index, unsigned int vaddr,
+                         unsigned int npages, unsigned int perm)
+{
+    unsigned int vas[ALLOC_BATCH], pages[ALLOC_BATCH];
+    unsigned int n, i, run, mapped;
+
+    pdir_use_kern();
+
+    mapped = 0;
+    while (npages > 0) {
+        // Collects the unmapped pages of the next chunk.
+        n = 0;
+        while (npages > 0 && n < ALLOC_BATCH) {
+            if ((get_ptbl_entry_by_va(proc_index, vaddr) & PTE_P) == 0) {
+                vas[n++] = vaddr;
+            }
+            vaddr += PAGESIZE;
+            npages--;
+        }
+        if (n == 0) {
+            continue;
+        }
+
+        if (container_alloc_zeroed_batch(proc_index, pages, n) == 0) {
+            return MagicNumber;
+        }
+        for (i = 0; i < n; i += run) {
+            run = 1;
+            while (i + run < n && vas[i + run] == vas[i] + run * PAGESIZE) {
+                run++;
+            }
+            if (map_range(proc_index, vas[i], pages + i, run, perm) == MagicNumber) {
+                unmap_range(proc_index, vas[i], run, NULL);
+                container_free_batch(proc_index, pages + i, n - i);
+                return MagicNumber;
+            }
+        }
+        mapped += n;
+    }
+
+    return mapped;
+}
+
+/**
+ * Duplicates the user part of the page structure of process # [from] into the
+ * page structure of process # [to], which must have no user mappings yet.
+ * The child gets its own page tables, but the physical pages are shared
+ * (with container_share, which charges them to the child's container and
+ * takes a reference on them). Writable pages are made read-only and marked
+ * with PTE_COW in both page structures, so the first write to such a page
+ * by either process copies it (see copy_on_write). The 4MB pages of the
+ * parent are split into page tables first (see split_large_page).
+ * It returns 0, or MagicNumber in the case of error, when the pages shared
+ * so far stay mapped in the child.
+ * Either way, the writable translations of the parent are dropped from the
+ * TLBs of all the CPUs that have its page structure loaded (see
+ * tlb_flush_range).
+ */
+unsigned int pdir_copy_cow(unsigned int from, unsigned int to)
+{
+    unsigned int pde_index, pte_index, pte, perm;
+    unsigned int nr_cow = 0, ret = 0;
+
+    for (pde_index = VM_USERLO_PDE; pde_index < VM_USERHI_PDE && ret == 0;
+         pde_index++) {
+        if (get_pdir_entry(from, pde_index) == 0) {
+            continue;
+        }
+        // The pages of a 4MB page are shared one by one.
+        if (split_large_page(from, pde_index * PDIRSIZE) == MagicNumber
+            || alloc_ptbl(to, pde_index * PDIRSIZE) == 0) {
+            ret = MagicNumber;
+            break;
+        }
+
+        for (pte_index = 0; pte_index < 1024; pte_index++) {
+            pte = get_ptbl_entry(from, pde_index, pte_index);
+            if ((pte & PTE_P) == 0) {
+                continue;
+            }
+            if (container_share(to, pte >> 12) == 0) {
+                ret = MagicNumber;
+                break;
+            }
+
+            perm = pte & 0xfff & ~(PTE_A | PTE_D | PTE_HOT);
+            if (perm & (PTE_W | PTE_COW)) {
+                perm = (perm & ~PTE_W) | PTE_COW;
+                set_ptbl_entry(from, pde_index, pte_index, pte >> 12, perm);
+                nr_cow++;
+            }
+            set_ptbl_entry(to, pde_index, pte_index, pte >> 12, perm);
+        }
+    }
+
+    if (nr_cow != 0) {
+        tlb_flush_range(from, VM_USERLO, (VM_USERHI - VM_USERLO) / PAGESIZE);
+    }
+
+    return ret;
+}
+
+/**
+ * Resolves a write to the copy-on-write page at [vaddr] of process
+ * # [proc_index]. The last process that references the page just gets it
+ * writable again, the others get a private copy of it.
+ * It returns 0, or MagicNumber if the page is not a copy-on-write page, or
+ * a new page cannot be allocated.
+ */
+unsigned int copy_on_write(unsigned int proc_index, unsigned int vaddr)
+{
+    unsigned int pte, old_page, new_page, perm;
+
+    vaddr &= ~(PAGESIZE - 1);
+    pte = get_ptbl_entry_by_va(proc_index, vaddr);
+    if ((pte & PTE_P) == 0 || (pte & PTE_COW) == 0) {
+        return MagicNumber;
+    }
+
+    old_page = pte >> 12;
+    perm = ((pte & 0xfff) & ~(PTE_COW | PTE_A | PTE_D | PTE_HOT)) | PTE_W;
+
+    // The other CPUs that have the page structure loaded may still have the
+    // read-only translation of the page, which is dropped through the same
+    // path as the other changes (see tlb_flush_range).
+    if (at_get_ref(old_page) == 1) {
+        set_ptbl_entry_by_va(proc_index, vaddr, old_page, perm);
+        tlb_flush_range(proc_index, vaddr, 1);
+    } else {
+        // The pages are allocated, copied and freed through the identity map.
+        pdir_use_kern();
+        new_page = container_alloc(proc_index);
+        if (new_page == 0) {
+            return MagicNumber;
+        }
+        memcpy((void *) (new_page * PAGESIZE), (void *) (old_page * PAGESIZE),
+               PAGESIZE);
+        set_ptbl_entry_by_va(proc_index, vaddr, new_page, perm);
+        tlb_flush_range(proc_index, vaddr, 1);
+        // Drops the reference of this process to the shared page.
+        container_free(proc_index, old_page);
+    }
+
+    return 0;
+}
+
+/**
+ * Tears down the user part of the page structure of process # [proc_index],
+ * e.g., when it exits. The page directory is walked once: the pages mapped by
+ * each page table are freed FREE_BATCH at a time (with container_free_batch),
+ * and then the page table itself (with free_ptbl), while a 4MB page is freed
+ * as a whole. Shared pages just lose the reference of the process.
+ * The page structure must not be loaded on any CPU, so no TLB is flushed.
+ * It returns the number of pages given back to the container.
+ */
+unsigned int pdir_free(unsigned int proc_index)
+{
+    unsigned int pages[FREE_BATCH];
+    unsigned int pde_index, pte_index, pde, n, nfree;
+
+    pdir_use_kern();
+
+    nfree = 0;
+    for (pde_index = VM_USERLO_PDE; pde_index < VM_USERHI_PDE; pde_index++) {
+        pde = get_pdir_entry(proc_index, pde_index);
+        if (pde == 0) {
+            continue;
+        }
+        if (pde & PTE_PS) {
+            rmv_pdir_entry(proc_index, pde_index);
+            container_free_contig(proc_index, pde >> 12, 1024);
+            nfree += 1024;
+            continue;
+        }
+
+        for (pte_index = 0; pte_index < 1024; pte_index += FREE_BATCH) {
+            n = rmv_ptbl_entries(proc_index, pde_index, pte_index, FREE_BATCH, pages);
+            container_free_batch(proc_index, pages, n);
+            nfree += n;
+        }
+        free_ptbl(proc_index, pde_index * PDIRSIZE);
+        nfree++;
+    }
+
+    return nfree;
+}
+
 /**
  * Designate some memory quota for the next child process.
  */
@@ -5,6 +5,11 @@
 
 unsigned int alloc_page(unsigned int proc_index, unsigned int vaddr,
                         unsigned int perm);
+unsigned int alloc_pages(unsigned int proc_index, unsigned int vaddr,
+                         unsigned int npages, unsigned int perm);
+unsigned int pdir_copy_cow(unsigned int from, unsigned int to);
+unsigned int copy_on_write(unsigned int proc_index, unsigned int vaddr);
+unsigned int pdir_free(unsigned int proc_index);
 unsigned int alloc_mem_quota(unsigned int id, unsigned int quota);
 
 #endif  /* _KERN_ */
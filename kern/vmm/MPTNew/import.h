@@ -3,10 +3,41 @@
 
 #ifdef _KERN_
 
-unsigned int container_alloc(unsigned int id);
+unsigned int container_alloc_zeroed(unsigned int id);
+unsigned int container_alloc_zeroed_batch(unsigned int id, unsigned int *pages, unsigned int n);
+void container_free_batch(unsigned int id, unsigned int *pages, unsigned int n);
+void pdir_use_kern(void);
+unsigned int get_ptbl_entry_by_va(unsigned int proc_index, unsigned int vaddr);
 unsigned int container_split(unsigned int id, unsigned int quota);
+unsigned int container_alloc(unsigned int id);
+void container_free(unsigned int id, unsigned int page_index);
+unsigned int container_share(unsigned int id, unsigned int page_index);
+unsigned int at_get_ref(unsigned int page_index);
+unsigned int get_pdir_entry(unsigned int proc_index, unsigned int pde_index);
+unsigned int get_ptbl_entry(unsigned int proc_index, unsigned int pde_index,
+                            unsigned int pte_index);
+void set_ptbl_entry(unsigned int proc_index, unsigned int pde_index,
+                    unsigned int pte_index, unsigned int page_index,
+                    unsigned int perm);
+void set_ptbl_entry_by_va(unsigned int proc_index, unsigned int vaddr,
+                          unsigned int page_index, unsigned int perm);
+unsigned int alloc_ptbl(unsigned int proc_index, unsigned int vaddr);
+void free_ptbl(unsigned int proc_index, unsigned int vaddr);
+void rmv_pdir_entry(unsigned int proc_index, unsigned int pde_index);
+unsigned int rmv_ptbl_entries(unsigned int proc_index, unsigned int pde_index,
+                              unsigned int pte_index, unsigned int n,
+                              unsigned int *pages);
+void container_free_contig(unsigned int id, unsigned int page_index, unsigned int npages);
 unsigned int map_page(unsigned int proc_index, unsigned int vaddr,
                       unsigned int page_index, unsigned int perm);
+unsigned int map_range(unsigned int proc_index, unsigned int vaddr,
+                       unsigned int *pages, unsigned int npages,
+                       unsigned int perm);
+unsigned int unmap_range(unsigned int proc_index, unsigned int vaddr,
+                         unsigned int npages, unsigned int *pages);
+unsigned int split_large_page(unsigned int proc_index, unsigned int vaddr);
+void tlb_flush_range(unsigned int proc_index, unsigned int vaddr,
+                     unsigned int npages);
 
 #endif  /* _KERN_ */
 
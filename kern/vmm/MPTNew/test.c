@@ -1,4 +1,12 @@
 #include <lib/debug.h>
+#include <lib/elf.h>
+#include <lib/gcc.h>
+#include <lib/pmap.h>
+#include <lib/string.h>
+#include <lib/vmregion.h>
+#include <lib/x86.h>
+#include <dev/tsc.h>
+#include <pmm/MATIntro/export.h>
 #include <pmm/MContainer/export.h>
 #include <vmm/MPTOp/export.h>
 #include <vmm/MPTNew/export.h>
@@ -29,6 +37,485 @@ int MPTNew_test1()
     return 0;
 }
 
+int MPTNew_test2()
+{
+    unsigned int vaddr = 4096 * 1024 * 401;
+    unsigned int usage = container_get_usage(1);
+    unsigned int i;
+    alloc_page(1, vaddr + 4096 * 2, 7);
+    // The already mapped page is skipped.
+    if (alloc_pages(1, vaddr, 5, 7) != 4) {
+        dprintf("test 2.1 failed: (%d != 4)\n", alloc_pages(1, vaddr, 5, 7));
+        return 1;
+    }
+    for (i = 0; i < 5; i++) {
+        if ((get_ptbl_entry_by_va(1, vaddr + 4096 * i) & 7) != 7) {
+            dprintf("test 2.2 failed (i = %d): (%d == 0)\n", i,
+                    get_ptbl_entry_by_va(1, vaddr + 4096 * i));
+            return 1;
+        }
+    }
+    // One page table and five pages.
+    if (container_get_usage(1) != usage + 6) {
+        dprintf("test 2.3 failed: (%d != %d)\n", container_get_usage(1), usage + 6);
+        return 1;
+    }
+    dprintf("test 2 passed.\n");
+    return 0;
+}
+
+/**
+ * Copy throughput benchmark: copies a buffer of COPY_PAGES pages to a process
+ * and back with pt_copyout and pt_copyin, and prints the throughput next to
+ * the one of a plain memcpy between two kernel buffers.
+ */
+#define COPY_PAGES  32
+#define COPY_ROUNDS 32
+
+static char copy_src[COPY_PAGES * 4096] gcc_aligned(4096);
+static char copy_dst[COPY_PAGES * 4096] gcc_aligned(4096);
+
+// Returns the throughput of copying [bytes] bytes in [cycles] cycles in MB/s.
+static unsigned int copy_mbps(unsigned long long bytes, unsigned long long cycles)
+{
+    if (cycles == 0) {
+        return 0;
+    }
+    return (unsigned int) (bytes * tsc_per_ms * 1000 / cycles / (1024 * 1024));
+}
+
+int MPTNew_test3()
+{
+    unsigned int vaddr = 4096 * 1024 * 402;
+    unsigned long long bytes = (unsigned long long) COPY_PAGES * 4096 * COPY_ROUNDS;
+    unsigned long long t_out, t_in, t_mem, start;
+    unsigned int i;
+
+    for (i = 0; i < sizeof(copy_src); i++) {
+        copy_src[i] = (char) (i * 7);
+    }
+
+    // Process 1 has no regions to fault the pages in from, so they are mapped
+    // here, and the first copy warms the caches up.
+    if (alloc_pages(1, vaddr, COPY_PAGES, PTE_P | PTE_W | PTE_U) != COPY_PAGES
+        || pt_copyout(copy_src, 1, vaddr, sizeof(copy_src)) != sizeof(copy_src)) {
+        dprintf("test 3.1 failed: pt_copyout\n");
+        return 1;
+    }
+
+    start = rdtsc();
+    for (i = 0; i < COPY_ROUNDS; i++) {
+        pt_copyout(copy_src, 1, vaddr, sizeof(copy_src));
+    }
+    t_out = rdtsc() - start;
+
+    start = rdtsc();
+    for (i = 0; i < COPY_ROUNDS; i++) {
+        pt_copyin(1, vaddr, copy_dst, sizeof(copy_dst));
+    }
+    t_in = rdtsc() - start;
+
+    if (memcmp(copy_src, copy_dst, sizeof(copy_src)) != 0) {
+        dprintf("test 3.2 failed: the copied data differs\n");
+        return 1;
+    }
+
+    start = rdtsc();
+    for (i = 0; i < COPY_ROUNDS; i++) {
+        memcpy(copy_dst, copy_src, sizeof(copy_src));
+    }
+    t_mem = rdtsc() - start;
+
+    // An unaligned copy across the pages goes through the partial chunks.
+    if (pt_copyin(1, vaddr + 100, copy_dst, 3 * 4096) != 3 * 4096
+        || memcmp(copy_src + 100, copy_dst, 3 * 4096) != 0) {
+        dprintf("test 3.3 failed: the unaligned copy differs\n");
+        return 1;
+    }
+
+    dprintf("copy of %d KB x %d: pt_copyout %u MB/s, pt_copyin %u MB/s, "
+            "memcpy %u MB/s.\n", COPY_PAGES * 4, COPY_ROUNDS,
+            copy_mbps(bytes, t_out), copy_mbps(bytes, t_in), copy_mbps(bytes, t_mem));
+    dprintf("test 3 passed.\n");
+    return 0;
+}
+
+int MPTNew_test4()
+{
+    unsigned int vaddr = 4096 * 1024 * 400;
+    unsigned int child = container_split(0, 500);
+    unsigned int page, pte, *p;
+
+    if (child == NUM_IDS) {
+        dprintf("test 4.1 failed: cannot split the container\n");
+        return 1;
+    }
+    page = get_ptbl_entry_by_va(1, vaddr) >> 12;
+    p = (unsigned int *) (page << 12);
+    *p = 0x12345678;
+
+    if (pdir_copy_cow(1, child) != 0) {
+        dprintf("test 4.2 failed: pdir_copy_cow\n");
+        return 1;
+    }
+    pte = get_ptbl_entry_by_va(child, vaddr);
+    if (pte >> 12 != page || (pte & PTE_W) || !(pte & PTE_COW)
+        || (get_ptbl_entry_by_va(1, vaddr) & PTE_W) || at_get_ref(page) != 2) {
+        dprintf("test 4.3 failed: (%d, %d, %d)\n", pte,
+                get_ptbl_entry_by_va(1, vaddr), at_get_ref(page));
+        return 1;
+    }
+
+    // The child gets a copy of the shared page.
+    if (copy_on_write(child, vaddr + 8) != 0) {
+        dprintf("test 4.4 failed: copy_on_write\n");
+        return 1;
+    }
+    pte = get_ptbl_entry_by_va(child, vaddr);
+    if (pte >> 12 == page || !(pte & PTE_W) || (pte & PTE_COW)
+        || *(unsigned int *) (pte & 0xfffff000) != 0x12345678 || at_get_ref(page) != 1) {
+        dprintf("test 4.5 failed: (%d, %d)\n", pte, at_get_ref(page));
+        return 1;
+    }
+
+    // The parent is the last one to reference the page, so it keeps it.
+    copy_on_write(1, vaddr);
+    pte = get_ptbl_entry_by_va(1, vaddr);
+    if (pte >> 12 != page || !(pte & PTE_W) || (pte & PTE_COW)) {
+        dprintf("test 4.6 failed: (%d)\n", pte);
+        return 1;
+    }
+    if (copy_on_write(1, vaddr) != MagicNumber) {
+        dprintf("test 4.7 failed: a writable page is not copy-on-write\n");
+        return 1;
+    }
+    dprintf("test 4 passed.\n");
+    return 0;
+}
+
+int MPTNew_test5()
+{
+    // Eight pages across the boundary of two 4MB slots.
+    unsigned int vaddr = 4096 * 1024 * 403 - 4096 * 4;
+    unsigned int child = container_split(0, 100);
+
+    if (child == NUM_IDS || alloc_pages(child, vaddr, 8, PTE_P | PTE_W | PTE_U) != 8
+        || container_get_usage(child) != 10) {
+        dprintf("test 5.1 failed: (%d != 10)\n", container_get_usage(child));
+        return 1;
+    }
+    if (pdir_free(child) != 10 || container_get_usage(child) != 0) {
+        dprintf("test 5.2 failed: (%d != 0)\n", container_get_usage(child));
+        return 1;
+    }
+    if (get_pdir_entry_by_va(child, vaddr) != 0
+        || get_pdir_entry_by_va(child, vaddr + 4096 * 4) != 0) {
+        dprintf("test 5.3 failed: (%d != 0)\n", get_pdir_entry_by_va(child, vaddr));
+        return 1;
+    }
+    if (container_destroy(child) != 1) {
+        dprintf("test 5.4 failed: container_destroy\n");
+        return 1;
+    }
+    dprintf("test 5 passed.\n");
+    return 0;
+}
+
+/**
+ * The regions of a test process: vmr_mmap places them first fit and rejects
+ * overlaps, and vmr_munmap gives the mapped pages back to the container and
+ * trims, splits or drops the regions, and splits the 4MB pages that are only
+ * partly unmapped.
+ */
+#define MMAP_LO  0x80000000  /* VM_MMAPLO */
+#define MMAP_PERM (PTE_P | PTE_W | PTE_U)
+
+// Whether the region of process pid that contains va is [start, end).
+static int vmr_is(unsigned int pid, unsigned int va, unsigned int start, unsigned int end)
+{
+    struct vm_region *r = vmr_find(pid, va);
+
+    return r != NULL && r->start == start && r->end == end;
+}
+
+int MPTNew_test6()
+{
+    unsigned int pid = container_split(0, 1100);
+    unsigned int a, b, l, usage, n;
+
+    if (pid == NUM_IDS) {
+        dprintf("test 6.1 failed: cannot split the container\n");
+        return 1;
+    }
+    vmr_init(pid);
+    a = vmr_mmap(pid, 0, 8 * 4096, MMAP_PERM, FALSE);
+    b = vmr_mmap(pid, 0, 8 * 4096 - 100, MMAP_PERM, FALSE);
+    if (a != MMAP_LO || b != MMAP_LO + 8 * 4096
+        || vmr_mmap(pid, a + 4096, 4096, MMAP_PERM, FALSE) != 0
+        || vmr_mmap(pid, b + 7 * 4096, 8192, MMAP_PERM, FALSE) != 0) {
+        dprintf("test 6.2 failed: (%x, %x)\n", a, b);
+        return 1;
+    }
+
+    // One page table and the eight pages of a.
+    vmr_prefault(pid, a, 8);
+    usage = container_get_usage(pid);
+    if (usage != 9) {
+        dprintf("test 6.3 failed: (%d != 9)\n", usage);
+        return 1;
+    }
+    // A hole in the middle, then a prefix, a suffix and the rest.
+    if (vmr_munmap(pid, a + 2 * 4096, 2 * 4096) != 2 || container_get_usage(pid) != 7
+        || !vmr_is(pid, a, a, a + 2 * 4096) || vmr_find(pid, a + 3 * 4096) != NULL
+        || !vmr_is(pid, a + 4 * 4096, a + 4 * 4096, a + 8 * 4096)) {
+        dprintf("test 6.4 failed: (%d != 7)\n", container_get_usage(pid));
+        return 1;
+    }
+    if (vmr_munmap(pid, a, 4096) != 1 || container_get_usage(pid) != 6
+        || vmr_find(pid, a) != NULL || !vmr_is(pid, a + 4096, a + 4096, a + 2 * 4096)) {
+        dprintf("test 6.5 failed: (%d != 6)\n", container_get_usage(pid));
+        return 1;
+    }
+    if (vmr_munmap(pid, a + 7 * 4096, 4096) != 1 || container_get_usage(pid) != 5
+        || !vmr_is(pid, a + 4 * 4096, a + 4 * 4096, a + 7 * 4096)) {
+        dprintf("test 6.6 failed: (%d != 5)\n", container_get_usage(pid));
+        return 1;
+    }
+    if (vmr_munmap(pid, a, 8 * 4096) != 4 || container_get_usage(pid) != 1
+        || vmr_find(pid, a + 4096) != NULL || vmr_find(pid, a + 4 * 4096) != NULL
+        || !vmr_is(pid, b, b, b + 8 * 4096)) {
+        dprintf("test 6.7 failed: (%d != 1)\n", container_get_usage(pid));
+        return 1;
+    }
+    // The hole left by a is the first fit again.
+    if (vmr_mmap(pid, 0, 4096, MMAP_PERM, FALSE) != a) {
+        dprintf("test 6.8 failed: first fit\n");
+        return 1;
+    }
+
+    // Splitting a 4MB page at the unaligned ends of the range.
+    l = vmr_mmap(pid, 0, 2 * 4096 * 1024, MMAP_PERM, TRUE);
+    if (l != MMAP_LO + 4096 * 1024 || vmr_fault(pid, l) != 0
+        || !(get_pdir_entry_by_va(pid, l) & PTE_PS)
+        || container_get_usage(pid) != 1 + 1024) {
+        dprintf("test 6.9 failed: (%x, %d)\n", l, container_get_usage(pid));
+        return 1;
+    }
+    if (vmr_munmap(pid, l + 4096, 2 * 4096) != 2
+        || (get_pdir_entry_by_va(pid, l) & PTE_PS)
+        || get_ptbl_entry_by_va(pid, l) == 0 || get_ptbl_entry_by_va(pid, l + 4096) != 0
+        || container_get_usage(pid) != 2 + 1024 - 2) {
+        dprintf("test 6.10 failed: (%d != %d)\n", container_get_usage(pid), 2 + 1024 - 2);
+        return 1;
+    }
+    if (vmr_munmap(pid, l, 2 * 4096 * 1024) != 1024 - 2
+        || container_get_usage(pid) != 2 || vmr_find(pid, l) != NULL) {
+        dprintf("test 6.11 failed: (%d != 2)\n", container_get_usage(pid));
+        return 1;
+    }
+
+    // The stack, b and a take three slots; the others are filled.
+    for (n = 3; n < VMR_MAX; n++) {
+        if (vmr_mmap(pid, 0, 4096, MMAP_PERM, FALSE) == 0) {
+            dprintf("test 6.12 failed: (slot %d)\n", n);
+            return 1;
+        }
+    }
+    if (vmr_mmap(pid, 0, 4096, MMAP_PERM, FALSE) != 0
+        || vmr_munmap(pid, b + 4096, 4096) != -1 || !vmr_is(pid, b, b, b + 8 * 4096)) {
+        dprintf("test 6.13 failed: no free region slot\n");
+        return 1;
+    }
+
+    pdir_free(pid);
+    if (container_get_usage(pid) != 0 || container_destroy(pid) != 1) {
+        dprintf("test 6.14 failed: (%d != 0)\n", container_get_usage(pid));
+        return 1;
+    }
+    dprintf("test 6 passed.\n");
+    return 0;
+}
+
+/**
+ * The fault-around window of a test process with a quota of 20 pages: a fault
+ * maps the unmapped pages of the aligned block of the window that contains
+ * the faulting page, but only those of its region and page table, and never
+ * the last page of the quota.
+ */
+int MPTNew_test7()
+{
+    unsigned int pid = container_split(0, 20);
+    unsigned int slot = MMAP_LO + 4096 * 1024;
+    unsigned int r, s, t, u;
+
+    if (pid == NUM_IDS) {
+        dprintf("test 7.1 failed: cannot split the container\n");
+        return 1;
+    }
+    vmr_init(pid);
+    vmr_set_window(pid, 1000);
+    if (vmr_get_window(pid) != 20) {
+        dprintf("test 7.2 failed: (%d != 20)\n", vmr_get_window(pid));
+        return 1;
+    }
+
+    // The block of 8 pages is cut at the end of the region.
+    vmr_set_window(pid, 8);
+    r = vmr_mmap(pid, 0, 6 * 4096, MMAP_PERM, FALSE);
+    if (vmr_pgflt(pid, r + 2 * 4096) != 0 || vmr_get_npages(pid) != 6
+        || container_get_usage(pid) != 7) {
+        dprintf("test 7.3 failed: (%d != 6 || %d != 7)\n", vmr_get_npages(pid),
+                container_get_usage(pid));
+        return 1;
+    }
+    // A window of 1 only maps the faulting page, at the edge of the region.
+    vmr_set_window(pid, 1);
+    s = vmr_mmap(pid, 0, 4 * 4096, MMAP_PERM, FALSE);
+    if (s != r + 6 * 4096 || vmr_pgflt(pid, s + 3 * 4096) != 0
+        || vmr_get_npages(pid) != 7 || container_get_usage(pid) != 8
+        || get_ptbl_entry_by_va(pid, s + 2 * 4096) != 0) {
+        dprintf("test 7.4 failed: (%d != 7 || %d != 8)\n", vmr_get_npages(pid),
+                container_get_usage(pid));
+        return 1;
+    }
+    // A region across two page tables: only the slot of the fault is mapped.
+    vmr_set_window(pid, 8);
+    t = vmr_mmap(pid, slot - 2 * 4096, 8 * 4096, MMAP_PERM, FALSE);
+    if (t != slot - 2 * 4096 || vmr_pgflt(pid, slot) != 0
+        || vmr_get_npages(pid) != 13 || container_get_usage(pid) != 15
+        || get_ptbl_entry_by_va(pid, slot - 4096) != 0
+        || get_ptbl_entry_by_va(pid, slot + 5 * 4096) == 0) {
+        dprintf("test 7.5 failed: (%d != 13 || %d != 15)\n", vmr_get_npages(pid),
+                container_get_usage(pid));
+        return 1;
+    }
+    // The window stops before the last page of the quota.
+    u = vmr_mmap(pid, 0, 8 * 4096, MMAP_PERM, FALSE);
+    if (u != s + 4 * 4096 || vmr_pgflt(pid, u) != 0
+        || vmr_get_npages(pid) != 17 || container_get_usage(pid) != 19
+        || get_ptbl_entry_by_va(pid, u + 4 * 4096) != 0
+        || vmr_get_nfaults(pid) != 4) {
+        dprintf("test 7.6 failed: (%d != 17 || %d != 19)\n", vmr_get_npages(pid),
+                container_get_usage(pid));
+        return 1;
+    }
+
+    pdir_free(pid);
+    if (container_get_usage(pid) != 0 || container_destroy(pid) != 1) {
+        dprintf("test 7.7 failed: (%d != 0)\n", container_get_usage(pid));
+        return 1;
+    }
+    dprintf("test 7 passed.\n");
+    return 0;
+}
+
+/**
+ * The text pages shared by the instances of an ELF image: a small image is
+ * built with a read-only text page and a writable data segment, and loaded
+ * into two test processes. The text page is filled once, referenced by the
+ * cache of the loader and by each process that maps it, and outlives the
+ * process that filled it. An image whose segments share a page is rejected.
+ */
+#define ELF_TEXT_VA 0x50000000
+#define ELF_DATA_VA (ELF_TEXT_VA + 4096)
+#define ELF_MARK    0xc0dec0de
+
+static char elf_image[3 * 4096] gcc_aligned(4096);
+
+static void elf_image_build(unsigned int data_va)
+{
+    elfhdr *eh = (elfhdr *) elf_image;
+    proghdr *ph = (proghdr *) (elf_image + 64);
+    sechdr *sh = (sechdr *) (elf_image + 128);
+
+    memzero(elf_image, sizeof(elf_image));
+    eh->e_magic = ELF_MAGIC;
+    eh->e_phoff = 64;
+    eh->e_phnum = 2;
+    eh->e_shoff = 128;
+    eh->e_shnum = 2;
+    eh->e_shstrndx = 1;
+    sh[1].sh_type = ELF_SHT_STRTAB;
+    sh[1].sh_offset = 256;
+    sh[1].sh_size = 1;
+
+    ph[0].p_type = ELF_PROG_LOAD;
+    ph[0].p_offset = 4096;
+    ph[0].p_va = ELF_TEXT_VA;
+    ph[0].p_filesz = ph[0].p_memsz = 4096;
+    ph[0].p_flags = ELF_PROG_FLAG_READ | ELF_PROG_FLAG_EXEC;
+    ph[1].p_type = ELF_PROG_LOAD;
+    ph[1].p_offset = 2 * 4096;
+    ph[1].p_va = data_va;
+    ph[1].p_filesz = 100;
+    ph[1].p_memsz = 2 * 4096;
+    ph[1].p_flags = ELF_PROG_FLAG_READ | ELF_PROG_FLAG_WRITE;
+
+    *(unsigned int *) (elf_image + 4096) = ELF_MARK;
+}
+
+int MPTNew_test8()
+{
+    unsigned int pid1 = container_split(0, 50);
+    unsigned int pid2 = container_split(0, 50);
+    unsigned int page, pte;
+
+    if (pid1 == NUM_IDS || pid2 == NUM_IDS) {
+        dprintf("test 8.1 failed: cannot split the container\n");
+        return 1;
+    }
+    elf_image_build(ELF_DATA_VA);
+    if (elf_load(elf_image, pid1) != 0 || elf_load(elf_image, pid2) != 0) {
+        dprintf("test 8.2 failed: elf_load\n");
+        return 1;
+    }
+
+    // The first instance fills the page: its reference and the cache's.
+    if (vmr_fault(pid1, ELF_TEXT_VA) != 0) {
+        dprintf("test 8.3 failed: vmr_fault\n");
+        return 1;
+    }
+    pte = get_ptbl_entry_by_va(pid1, ELF_TEXT_VA);
+    page = pte >> 12;
+    if ((pte & PTE_W) || *(unsigned int *) (page << 12) != ELF_MARK
+        || at_get_ref(page) != 2) {
+        dprintf("test 8.4 failed: (%x, %d != 2)\n", pte, at_get_ref(page));
+        return 1;
+    }
+    // The second instance maps the same page, and the data stays private.
+    if (vmr_fault(pid2, ELF_TEXT_VA) != 0
+        || get_ptbl_entry_by_va(pid2, ELF_TEXT_VA) >> 12 != page
+        || at_get_ref(page) != 3
+        || vmr_fault(pid2, ELF_DATA_VA) != 0
+        || !(get_ptbl_entry_by_va(pid2, ELF_DATA_VA) & PTE_W)) {
+        dprintf("test 8.5 failed: (%x, %d != 3)\n",
+                get_ptbl_entry_by_va(pid2, ELF_TEXT_VA), at_get_ref(page));
+        return 1;
+    }
+    // The page outlives the instance that filled it.
+    pdir_free(pid1);
+    if (at_get_ref(page) != 2 || at_is_allocated(page) != 1
+        || *(unsigned int *) (page << 12) != ELF_MARK) {
+        dprintf("test 8.6 failed: (%d != 2)\n", at_get_ref(page));
+        return 1;
+    }
+    pdir_free(pid2);
+    if (at_get_ref(page) != 1 || container_destroy(pid1) != 1
+        || container_destroy(pid2) != 1) {
+        dprintf("test 8.7 failed: (%d != 1)\n", at_get_ref(page));
+        return 1;
+    }
+
+    // The data segment starts in the text page.
+    elf_image_build(ELF_TEXT_VA + 2048);
+    if (elf_load(elf_image, pid1) != -1) {
+        dprintf("test 8.8 failed: overlapping segments were loaded\n");
+        return 1;
+    }
+    dprintf("test 8 passed.\n");
+    return 0;
+}
+
 /**
  * Write Your Own Test Script (optional)
  *
@@ -51,5 +538,6 @@ int MPTNew_test_own()
 
 int test_MPTNew()
 {
-    return MPTNew_test1() + MPTNew_test_own();
+    return MPTNew_test1() + MPTNew_test2() + MPTNew_test3() + MPTNew_test4() + MPTNew_test5()
+        + MPTNew_test6() + MPTNew_test7() + MPTNew_test8() + MPTNew_test_own();
 }
@@ -63,15 +63,15 @@ void set_pdir_entry_by_va(unsigned int proc_index, unsigned int vaddr,
     set_pdir_entry(proc_index, PDE_ADDR(vaddr), page_index);
 }
 
-// Initializes the identity page table.
+// Initializes the identity map, one 4MB page per page directory entry.
 // The permission for the kernel memory should be PTE_P, PTE_W, and PTE_G,
 // While the permission for the rest should be PTE_P and PTE_W.
 void idptbl_init(unsigned int mbi_addr)
 {
-    unsigned int pde_index, pte_index, perm;
+    unsigned int pde_index, perm;
     container_init(mbi_addr);
 
-    // Set up IDPTbl
+    // Set up IDPDir
     for (pde_index = 0; pde_index < 1024; pde_index++) {
         if ((pde_index < VM_USERLO_PDE) || (VM_USERHI_PDE <= pde_index)) {
             // kernel mapping
@@ -81,8 +81,6 @@ void idptbl_init(unsigned int mbi_addr)
             perm = PTE_P | PTE_W;
         }
 
-        for (pte_index = 0; pte_index < 1024; pte_index++) {
-            set_ptbl_entry_identity(pde_index, pte_index, perm);
-        }
+        set_pdir_entry_identity_perm(pde_index, perm);
     }
 }
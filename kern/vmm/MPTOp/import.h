@@ -17,8 +17,7 @@ void set_ptbl_entry(unsigned int proc_index, unsigned int pde_index,
                     unsigned int perm);
 void rmv_ptbl_entry(unsigned int proc_index, unsigned int pde_index,
                     unsigned int pte_index);
-void set_ptbl_entry_identity(unsigned int pde_index, unsigned int pte_index,
-                             unsigned int perm);
+void set_pdir_entry_identity_perm(unsigned int pde_index, unsigned int perm);
 
 #endif  /* _KERN_ */
 
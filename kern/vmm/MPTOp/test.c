@@ -1,4 +1,7 @@
 #include <lib/debug.h>
+#include <lib/x86.h>
+#include <pmm/MATOp/export.h>
+#include <vmm/MPTIntro/export.h>
 #include "export.h"
 
 int MPTOp_test1()
@@ -36,6 +39,87 @@ int MPTOp_test1()
     return 0;
 }
 
+/**
+ * TLB miss benchmark: touches one word in every 4KB page of 64MB of kernel
+ * memory, once through the 4MB identity pages, and once through 4KB identity
+ * page tables like the ones the identity map used to be built of.
+ */
+#define TLB_PDE    16  // the first page directory entry of the region
+#define TLB_NPDE   16  // 16 * 4MB = 64MB
+#define TLB_ROUNDS 4
+
+static unsigned long long tlb_walk(void)
+{
+    volatile unsigned int *p;
+    unsigned long long start;
+    unsigned int round, addr;
+
+    tlb_flush_global();
+
+    start = rdtsc();
+    for (round = 0; round < TLB_ROUNDS; round++) {
+        for (addr = TLB_PDE << 22; addr < (TLB_PDE + TLB_NPDE) << 22; addr += 4096) {
+            p = (volatile unsigned int *) addr;
+            (void) *p;
+        }
+    }
+    return rdtsc() - start;
+}
+
+int MPTOp_test2()
+{
+    unsigned int ptbl[TLB_NPDE];
+    unsigned int proc_index = NUM_IDS - 1;
+    unsigned int i, j, *pt;
+    unsigned long long t_ps, t_4k;
+
+    // The kernel part of every page directory maps 4MB pages.
+    if ((get_pdir_entry_by_va(proc_index, TLB_PDE << 22) & PTE_PS) == 0
+        || get_ptbl_entry_by_va(proc_index, (TLB_PDE << 22) + 4096 * 5)
+        != (((TLB_PDE << 22) + 4096 * 5) | PTE_P | PTE_W | PTE_G)) {
+        dprintf("test 2.1 failed: (%d != %d)\n",
+                get_ptbl_entry_by_va(proc_index, (TLB_PDE << 22) + 4096 * 5),
+                ((TLB_PDE << 22) + 4096 * 5) | PTE_P | PTE_W | PTE_G);
+        return 1;
+    }
+
+    set_pdir_base(proc_index);
+    t_ps = tlb_walk();
+    set_pdir_base(0);
+
+    for (i = 0; i < TLB_NPDE; i++) {
+        ptbl[i] = palloc();
+        if (ptbl[i] == 0) {
+            dprintf("test 2.2 failed: out of pages\n");
+            while (i-- > 0) {
+                pfree(ptbl[i]);
+            }
+            return 1;
+        }
+        pt = (unsigned int *) (ptbl[i] << 12);
+        for (j = 0; j < 1024; j++) {
+            pt[j] = ((TLB_PDE + i) << 22) | (j << 12) | PTE_P | PTE_W | PTE_G;
+        }
+        set_pdir_entry(proc_index, TLB_PDE + i, ptbl[i]);
+    }
+
+    set_pdir_base(proc_index);
+    t_4k = tlb_walk();
+    set_pdir_base(0);
+
+    for (i = 0; i < TLB_NPDE; i++) {
+        set_pdir_entry_identity(proc_index, TLB_PDE + i);
+        pfree(ptbl[i]);
+    }
+    // The global 4KB entries of the freed page tables outlive the CR3 reload.
+    tlb_flush_global();
+
+    dprintf("walk of %d pages x %d: 4KB identity pages %llu cycles, 4MB pages %llu cycles.\n",
+            TLB_NPDE * 1024, TLB_ROUNDS, t_4k, t_ps);
+    dprintf("test 2 passed.\n");
+    return 0;
+}
+
 /**
  * Write Your Own Test Script (optional)
  *
@@ -58,5 +142,5 @@ int MPTOp_test_own()
 
 int test_MPTOp()
 {
-    return MPTOp_test1() + MPTOp_test_own();
+    return MPTOp_test1() + MPTOp_test2() + MPTOp_test_own();
 }
@@ -0,0 +1,65 @@
+#include <proc.h>
+#include <stdio.h>
+#include <syscall.h>
+#include <x86.h>
+
+// The CPU-bound processes the benchmark runs on its CPU, counting itself.
+#define FAIRBENCH_NPROCS 4
+#define FAIRBENCH_QUOTA  64
+
+// How long all the processes spin, from the start of the benchmark.
+#define FAIRBENCH_CYCLES 1000000000ULL
+
+// A longer gap between two iterations means the process was switched out.
+#define FAIRBENCH_GAP    100000
+
+/**
+ * Spins until FAIRBENCH_CYCLES after start, and prints how long it took the
+ * process to run for the first time, the iterations it got through, and the
+ * number of time slices it got. Without preemption, the first process to run
+ * takes all the time and the others do not get any.
+ */
+static void fairbench_spin(unsigned int idx, uint64_t start)
+{
+    uint64_t first, last, now;
+    unsigned int iters, slices;
+
+    iters = 0;
+    slices = 1;
+    first = last = rdtsc();
+    while ((now = rdtsc()) - start < FAIRBENCH_CYCLES) {
+        if (now - last > FAIRBENCH_GAP) {
+            slices++;
+        }
+        last = now;
+        iters++;
+    }
+
+    printf("fairbench: process %u (pid %d): first ran after %u cycles, %u iterations in %u slices.\n",
+           idx, sys_getpid(), (unsigned int) (first - start), iters, slices);
+}
+
+int main(int argc, char **argv)
+{
+    uint64_t start;
+    unsigned int i;
+    pid_t pid;
+
+    printf("fairbench started: %d CPU-bound processes.\n", FAIRBENCH_NPROCS);
+
+    start = rdtsc();
+    for (i = 1; i < FAIRBENCH_NPROCS; i++) {
+        pid = fork(FAIRBENCH_QUOTA);
+        if (pid == 0) {
+            fairbench_spin(i, start);
+            return 0;
+        }
+        if (pid < 0) {
+            printf("fairbench: fork failed.\n");
+            break;
+        }
+    }
+    fairbench_spin(0, start);
+
+    return 0;
+}
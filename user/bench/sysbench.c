@@ -0,0 +1,173 @@
+#include <proc.h>
+#include <stdio.h>
+#include <syscall.h>
+#include <x86.h>
+
+#define SYSBENCH_ROUNDS 1000
+
+// The number of fresh pages the fault-around benchmark touches per window size.
+#define FAULTBENCH_PAGES 64
+
+// The buffer the streaming benchmark reads, one word per cache line.
+#define STREAMBENCH_SIZE   (8 * 1024 * 1024)
+#define STREAMBENCH_PASSES 8
+
+// The pages the working set benchmark maps, and the ones it keeps using.
+#define WSETBENCH_PAGES 256
+#define WSETBENCH_HOT   32
+
+/**
+ * Returns the average number of cycles of a getpid round trip.
+ */
+static unsigned int sysbench_round_trip(void)
+{
+    unsigned int i;
+    uint64_t start;
+
+    start = rdtsc();
+    for (i = 0; i < SYSBENCH_ROUNDS; i++) {
+        sys_getpid();
+    }
+    return (unsigned int) (rdtsc() - start) / SYSBENCH_ROUNDS;
+}
+
+/**
+ * Touches FAULTBENCH_PAGES fresh pages one after the other with the given
+ * fault-around window, and prints the faults it took and the cycles it spent.
+ * The pages are mapped with sys_mmap, and given back with sys_munmap.
+ */
+static void faultbench(unsigned int window)
+{
+    unsigned int i, old, faults0, pages0, faults, pages;
+    unsigned int base;
+    uint64_t start;
+    unsigned int cycles;
+    int nfree;
+
+    base = (unsigned int) sys_mmap(NULL, FAULTBENCH_PAGES * PAGESIZE, MMAP_WRITE);
+    if (base == 0) {
+        printf("faultbench: mmap failed.\n");
+        return;
+    }
+
+    old = sys_fault_around(window, &faults0, &pages0);
+    start = rdtsc();
+    for (i = 0; i < FAULTBENCH_PAGES; i++) {
+        *(volatile unsigned int *) (base + i * PAGESIZE) = i;
+    }
+    cycles = (unsigned int) (rdtsc() - start);
+    sys_fault_around(old, &faults, &pages);
+
+    nfree = sys_munmap((void *) base, FAULTBENCH_PAGES * PAGESIZE);
+
+    printf("faultbench: window %u: %u pages touched, %u faults, %u pages mapped, %u cycles.\n",
+           window, FAULTBENCH_PAGES, faults - faults0, pages - pages0, cycles);
+    printf("faultbench: window %u: %d pages unmapped at 0x%08x.\n",
+           window, nfree, base);
+}
+
+/**
+ * Maps a STREAMBENCH_SIZE buffer with the given sys_mmap flags, touches each
+ * of its pages once, and then streams over it STREAMBENCH_PASSES times.
+ * Prints the faults and cycles of the first touch, and the cycles per pass.
+ */
+static void streambench(unsigned int flags, const char *name)
+{
+    volatile unsigned int *buf;
+    unsigned int i, pass, sum, faults0, faults, touch, stream;
+    uint64_t start;
+
+    buf = sys_mmap(NULL, STREAMBENCH_SIZE, MMAP_WRITE | flags);
+    if (buf == NULL) {
+        printf("streambench: %s: mmap failed.\n", name);
+        return;
+    }
+
+    sys_fault_around(0, &faults0, NULL);
+    start = rdtsc();
+    for (i = 0; i < STREAMBENCH_SIZE / 4; i += PAGESIZE / 4) {
+        buf[i] = i;
+    }
+    touch = (unsigned int) (rdtsc() - start);
+    sys_fault_around(0, &faults, NULL);
+
+    sum = 0;
+    start = rdtsc();
+    for (pass = 0; pass < STREAMBENCH_PASSES; pass++) {
+        for (i = 0; i < STREAMBENCH_SIZE / 4; i += 16) {
+            sum += buf[i];
+        }
+    }
+    stream = (unsigned int) (rdtsc() - start) / STREAMBENCH_PASSES;
+
+    sys_munmap((void *) buf, STREAMBENCH_SIZE);
+
+    printf("streambench: %s pages: first touch %u faults, %u cycles; %u cycles per pass (sum %u).\n",
+           name, faults - faults0, touch, stream, sum);
+}
+
+/**
+ * Maps and touches WSETBENCH_PAGES pages, and then keeps reading the first
+ * WSETBENCH_HOT of them, scanning its own pages after each phase.
+ * Prints the working set estimates, which should drop to the hot pages,
+ * while the resident pages stay the same.
+ */
+static void wsetbench(void)
+{
+    volatile unsigned int *buf;
+    struct wset_stat ws;
+    unsigned int i, round, sum;
+
+    buf = sys_mmap(NULL, WSETBENCH_PAGES * PAGESIZE, MMAP_WRITE);
+    if (buf == NULL) {
+        printf("wsetbench: mmap failed.\n");
+        return;
+    }
+
+    sys_wset(0, 1, &ws);  // starts from a clean scan
+    for (i = 0; i < WSETBENCH_PAGES; i++) {
+        buf[i * PAGESIZE / 4] = i;
+    }
+    if (sys_wset(0, 1, &ws) < 0) {
+        printf("wsetbench: wset failed.\n");
+        sys_munmap((void *) buf, WSETBENCH_PAGES * PAGESIZE);
+        return;
+    }
+    printf("wsetbench: all touched: %u resident, %u average, %u dirty, %u peak.\n",
+           ws.resident, ws.avg, ws.dirty, ws.peak);
+
+    sum = 0;
+    for (round = 0; round < 4; round++) {
+        for (i = 0; i < WSETBENCH_HOT; i++) {
+            sum += buf[i * PAGESIZE / 4];
+        }
+        sys_wset(0, 1, &ws);
+    }
+    printf("wsetbench: %u pages read: %u resident, %u average, %u hot, %u dirty, %u peak (sum %u).\n",
+           WSETBENCH_HOT, ws.resident, ws.avg, ws.hot, ws.dirty, ws.peak, sum);
+
+    sys_munmap((void *) buf, WSETBENCH_PAGES * PAGESIZE);
+}
+
+int main(int argc, char **argv)
+{
+    unsigned int cycles;
+
+    printf("sysbench started.\n");
+
+    // The kernel built with EAGER_CR3=1 switches page structures on every trap.
+    sysbench_round_trip();  // warm up
+    cycles = sysbench_round_trip();
+    printf("sysbench: getpid round trip: %u cycles.\n", cycles);
+
+    faultbench(1);
+    faultbench(8);
+    faultbench(32);
+
+    streambench(0, "4KB");
+    streambench(MMAP_LARGE, "4MB");
+
+    wsetbench();
+
+    return 0;
+}
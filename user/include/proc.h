@@ -4,8 +4,10 @@
 #include <types.h>
 
 pid_t spawn(unsigned int elf_id, unsigned int quota);
+pid_t fork(unsigned int quota);
 void yield(void);
 void produce(void);
 void consume(void);
+void exit(int status);
 
 #endif  /* !_USER_PROC_H_ */
@@ -59,4 +59,129 @@ static gcc_inline void sys_consume(void)
                   : "cc", "memory");
 }
 
+static gcc_inline pid_t sys_getpid(void)
+{
+    int errno;
+    pid_t pid;
+
+    asm volatile ("int %2"
+                  : "=a" (errno), "=b" (pid)
+                  : "i" (T_SYSCALL),
+                    "a" (SYS_getpid)
+                  : "cc", "memory");
+
+    return errno ? -1 : pid;
+}
+
+static gcc_inline pid_t sys_fork(unsigned int quota)
+{
+    int errno;
+    pid_t pid;
+
+    asm volatile ("int %2"
+                  : "=a" (errno), "=b" (pid)
+                  : "i" (T_SYSCALL),
+                    "a" (SYS_fork),
+                    "b" (quota)
+                  : "cc", "memory");
+
+    return errno ? -1 : pid;
+}
+
+static gcc_inline unsigned int sys_fault_around(unsigned int window,
+                                                unsigned int *nfaults,
+                                                unsigned int *npages)
+{
+    int errno;
+    unsigned int old, faults, pages;
+
+    asm volatile ("int %4"
+                  : "=a" (errno), "=b" (old), "=c" (faults), "=d" (pages)
+                  : "i" (T_SYSCALL),
+                    "a" (SYS_fault_around),
+                    "b" (window)
+                  : "cc", "memory");
+
+    if (nfaults)
+        *nfaults = faults;
+    if (npages)
+        *npages = pages;
+    return old;
+}
+
+static gcc_inline void *sys_mmap(void *addr, size_t len, unsigned int flags)
+{
+    int errno;
+    unsigned int va;
+
+    asm volatile ("int %2"
+                  : "=a" (errno), "=b" (va)
+                  : "i" (T_SYSCALL),
+                    "a" (SYS_mmap),
+                    "b" (addr),
+                    "c" (len),
+                    "d" (flags)
+                  : "cc", "memory");
+
+    return errno ? NULL : (void *) va;
+}
+
+static gcc_inline int sys_munmap(void *addr, size_t len)
+{
+    int errno;
+    unsigned int nfree;
+
+    asm volatile ("int %2"
+                  : "=a" (errno), "=b" (nfree)
+                  : "i" (T_SYSCALL),
+                    "a" (SYS_munmap),
+                    "b" (addr),
+                    "c" (len)
+                  : "cc", "memory");
+
+    return errno ? -1 : nfree;
+}
+
+static gcc_inline void sys_exit(int status)
+{
+    asm volatile ("int %0"
+                  :: "i" (T_SYSCALL),
+                     "a" (SYS_exit),
+                     "b" (status)
+                  : "cc", "memory");
+}
+
+struct wset_stat {
+    unsigned int avg;       /* the pages accessed per scan period, on average */
+    unsigned int hot;       /* the pages accessed in both of the last two periods */
+    unsigned int dirty;     /* the pages written in the last period */
+    unsigned int resident;  /* the pages mapped */
+    unsigned int peak;      /* the largest number of pages accessed in a period */
+};
+
+static gcc_inline int sys_wset(pid_t pid, int scan, struct wset_stat *ws)
+{
+    int errno;
+    unsigned int avg, hot, dirty, resident, peak;
+
+    asm volatile ("int %6"
+                  : "=a" (errno), "=b" (avg), "=c" (hot), "=d" (dirty),
+                    "=S" (resident), "=D" (peak)
+                  : "i" (T_SYSCALL),
+                    "a" (SYS_wset),
+                    "b" (pid),
+                    "c" (scan)
+                  : "cc", "memory");
+
+    if (errno)
+        return -1;
+
+    ws->avg = avg;
+    ws->hot = hot;
+    ws->dirty = dirty;
+    ws->resident = resident;
+    ws->peak = peak;
+    return 0;
+}
+
 #endif  /* !_USER_SYSCALL_H_ */
@@ -7,6 +7,11 @@ pid_t spawn(uintptr_t exec, unsigned int quota)
     return sys_spawn(exec, quota);
 }
 
+pid_t fork(unsigned int quota)
+{
+    return sys_fork(quota);
+}
+
 void yield(void)
 {
     sys_yield();
@@ -21,3 +26,8 @@ void consume(void)
 {
     sys_consume();
 }
+
+void exit(int status)
+{
+    sys_exit(status);
+}